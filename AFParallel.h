@@ -0,0 +1,70 @@
+#ifndef AFPARALLEL_H
+#define AFPARALLEL_H
+
+#include "RVersion.h"
+#include "TROOT.h"
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,0,0)
+#include "TThread.h"
+#endif
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+///
+/// Minimal helpers to run independent jobs on a bounded number of threads
+///
+
+namespace AFParallel
+{
+  /// Must be called before using ROOT (e.g. opening files) from several threads
+  inline void EnableThreadSafety()
+  {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    ROOT::EnableThreadSafety();
+#else
+    TThread::Initialize();
+#endif
+  }
+
+  /// Call job(i) for each i in [0,n[, using at most nthreads threads.
+  /// Jobs are started in increasing order of i, so callers wanting
+  /// e.g. the largest jobs first just have to sort them accordingly.
+  /// With nthreads <= 1 everything is done in the calling thread.
+  template<typename Job>
+  void ForEach(std::size_t n, int nthreads, Job job)
+  {
+    if ( nthreads <= 1 || n <= 1 )
+    {
+      for ( std::size_t i = 0; i < n; ++i )
+      {
+        job(i);
+      }
+      return;
+    }
+
+    EnableThreadSafety();
+
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> threads;
+
+    for ( std::size_t t = 0; t < static_cast<std::size_t>(nthreads) && t < n; ++t )
+    {
+      threads.push_back(std::thread([&]()
+      {
+        std::size_t i;
+        while ( ( i = next++ ) < n )
+        {
+          job(i);
+        }
+      }));
+    }
+
+    for ( std::vector<std::thread>::size_type t = 0; t < threads.size(); ++t )
+    {
+      threads[t].join();
+    }
+  }
+}
+
+#endif
@@ -1,11 +1,13 @@
 #include "AFStatic.h"
 
+#include "AFParallel.h"
 #include "Riostream.h"
 #include "TFileCollection.h"
 #include "TFileInfo.h"
 #include "TGrid.h"
 #include "TGridCollection.h"
 #include "TGridResult.h"
+#include "TMath.h"
 #include "THashList.h"
 #include "TString.h"
 #include "TSystem.h"
@@ -19,10 +21,26 @@
 #include <string>
 #include <algorithm>
 #include "TObjArray.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace
 {
   Double_t byte2GB(1024*1024*1024);
+  
+  // the catalogue answers for one run
+  struct RunQuery
+  {
+    RunQuery() : fBaseName(), fSearch(), fMessages(), fResult(), fArchives() {}
+    
+    TString fBaseName;
+    TString fSearch;
+    TString fMessages; // to be printed when the run is dealt with
+    std::unique_ptr<TGridResult> fResult; // the requested files
+    std::unique_ptr<TGridResult> fArchives; // their root_archive.zip (if computing the total size)
+  };
 }
 
 using namespace std;
@@ -192,48 +210,106 @@ TFileCollection* AFStatic::CreateCollectionFromRunList(const char* collectionTyp
   
   if ( what == "root_archive.zip" ) computeTotalSize = kFALSE;
   
-  for ( std::vector<int>::const_iterator it = runs.begin(); it != runs.end(); ++it ) 
-  { 
-    Int_t runNumber = (*it);
+  std::vector<RunQuery> queries(runs.size());
+  
+  for ( std::vector<int>::size_type r = 0; r < runs.size(); ++r )
+  {
+    GetSearchAndBaseName(runs[r],basename, what, sdatatype.Data(), esdpass, aodPassNumber,queries[r].fBaseName, queries[r].fSearch);
+  }
+  
+  // the queries are latency bound, so issue up to Parallelism() of them at the same time,
+  // each on its own connection (the first one being the existing gGrid)
+  TGrid* mainGrid = gGrid;
+  std::vector<TGrid*> grids(1,mainGrid);
+  std::vector<TGrid*> freeGrids(grids);
+  Bool_t canConnect(kTRUE);
+  std::mutex mutex;
+  std::condition_variable released;
+  
+  AFParallel::ForEach(runs.size(),TMath::Max(Parallelism(),1),[&](std::size_t r)
+  {
+    TGrid* grid(0x0);
     
-    TString search;
-    TString mbasename;
-
-    GetSearchAndBaseName(runNumber,basename, what, sdatatype.Data(), esdpass, aodPassNumber,mbasename, search);
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      
+      while (!grid)
+      {
+        if ( !freeGrids.empty() )
+        {
+          grid = freeGrids.back();
+          freeGrids.pop_back();
+        }
+        else if ( canConnect )
+        {
+          grid = TGrid::Connect("alien://");
+          // Connect makes the new connection the global one
+          gGrid = mainGrid;
+          if (grid) grids.push_back(grid);
+          else canConnect = kFALSE;
+        }
+        else
+        {
+          released.wait(lock);
+        }
+      }
+    }
     
-    cout << Form("basename=%s search=%s",mbasename.Data(),search.Data()) << endl;
+    RunQuery& q = queries[r];
+    TString search(q.fSearch);
     
-    TGridResult* res = gGrid->Query(mbasename.Data(),search.Data());
+    q.fMessages = TString::Format("basename=%s search=%s\n",q.fBaseName.Data(),search.Data());
     
-    TGridResult* res2 = 0x0;
+    q.fResult.reset(grid->Query(q.fBaseName.Data(),search.Data()));
     
     if ( computeTotalSize && what != "root_archive.zip" ) 
     {
       search.ReplaceAll(what,"root_archive.zip");
       
-      res2 = gGrid->Query(mbasename.Data(),search.Data());
+      q.fArchives.reset(grid->Query(q.fBaseName.Data(),search.Data()));
     }
     
-    Int_t nFiles = res->GetEntries();
-    
-    if ( !nFiles && ( aodPassNumber < 0 ) )
+    if ( ( !q.fResult || !q.fResult->GetEntries() ) && ( aodPassNumber < 0 ) )
     {
       // try "merged" esds path
-      cout << "No result. Trying another path..." << endl;
-      cout << Form("basename=%s search=%s",mbasename.Data(),search.Data()) << endl;
+      q.fMessages += "No result. Trying another path...\n";
+      q.fMessages += TString::Format("basename=%s search=%s\n",q.fBaseName.Data(),search.Data());
 
 //      mbasename=Form("%s/%09d/ESDs/%s/*/*",basename,runNumber,esdpass);
-      mbasename=Form("%s/%09d/ESDs/%s/*",basename,runNumber,esdpass);
+      q.fBaseName=TString::Format("%s/%09d/ESDs/%s/*",basename,runs[r],esdpass);
       search = what.Data(); 
-      res = gGrid->Query(mbasename.Data(),search.Data());
+      q.fResult.reset(grid->Query(q.fBaseName.Data(),search.Data()));
       if ( computeTotalSize && what != "root_archive.zip" ) 
       {
         search.ReplaceAll(what,"root_archive.zip");        
-        res2 = gGrid->Query(mbasename.Data(),search.Data());
+        q.fArchives.reset(grid->Query(q.fBaseName.Data(),search.Data()));
       }
     }
     
-    nFiles = res->GetEntries();
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    freeGrids.push_back(grid);
+    released.notify_one();
+  });
+  
+  for ( std::vector<TGrid*>::size_type g = 1; g < grids.size(); ++g )
+  {
+    delete grids[g];
+  }
+  
+  gGrid = mainGrid;
+  
+  // assemble the results in run order
+  for ( std::vector<RunQuery>::size_type r = 0; r < queries.size(); ++r ) 
+  { 
+    RunQuery& q = queries[r];
+    
+    cout << q.fMessages.Data() << flush;
+    
+    TGridResult* res = q.fResult.get();
+    TGridResult* res2 = q.fArchives.get();
+    
+    Int_t nFiles = res ? res->GetEntries() : 0;
     
     if (!nFiles) 
     {
@@ -307,8 +383,8 @@ TFileCollection* AFStatic::CreateCollectionFromRunList(const char* collectionTyp
         totalSize += TString(res2->GetKey(i,"size")).Atoll();
       }
     }
-    delete res;
-    delete res2;
+    q.fResult.reset();
+    q.fArchives.reset();
   }
   
   TString summary(Form("numberoffiles=\"%d\" size=\"%7.2f GB\" ",count,size/byte2GB));
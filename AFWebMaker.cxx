@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
 #include "boost/algorithm/string/trim.hpp"
 
 int AFWebMaker::fgDebugLevel = 0;
@@ -26,6 +27,12 @@ namespace {
 
   double byte2GB(1024*1024*1024);
 
+  // time window (in days) used to compute the growth rates from the history
+  const double kTrendWindow(30.0);
+
+  // maximum number of curves in a trend chart
+  const std::vector<std::string>::size_type kMaxTrendCurves(10);
+
   void Tokenize(const std::string& str, std::vector<std::string>& tokens, char delim)
   {
     tokens.clear();
@@ -120,7 +127,8 @@ std::ostream& operator<<(std::ostream& os, const AFWebMaker::AFFileInfo& fileinf
 //_________________________________________________________________________________________________
 AFWebMaker::AFWebMaker(const std::string& topdir, const std::string& pattern,
                        const std::string& prefix, int debuglevel) :
-fTopDir(topdir), fFileListPattern(pattern), fPrefix(prefix), fDebugLevel(debuglevel)
+fTopDir(topdir), fFileListPattern(pattern), fPrefix(prefix), fDebugLevel(debuglevel),
+fHistoryFile(""), fServerCapacity(0), fRebalanceTolerance(-1.0), fRebalanceRate(0)
 {
   char hostname[1024];
 
@@ -179,6 +187,72 @@ void AFWebMaker::AddFileToGroup(const std::string& file, const AFWebMaker::AFFil
   list->push_back(fileInfo);
 }
 
+//_________________________________________________________________________________________________
+void AFWebMaker::AppendHistory()
+{
+  /// Append the group aggregates of this run to the history file.
+  ///
+  /// The history is a text file made of snapshots. Each snapshot starts with a
+  /// "T time" line, followed by one "nfiles size group" line for each group
+  /// which changed since the previous snapshot, where nfiles and size are the
+  /// differences with respect to the previous snapshot.
+
+  DEBUG(2) << "AppendHistory" << std::endl;
+
+  AFAggregateMap last;
+  std::vector<time_t> times;
+  AFHistorySeries series;
+
+  ReadHistory(last,times,series);
+
+  AFAggregateMap current;
+
+  for ( AFFileInfoMap::const_iterator it = GroupMap().begin(); it != GroupMap().end(); ++it )
+  {
+    AFAggregate& agg = current[it->first];
+    agg.fNFiles = it->second->size();
+    agg.fSize = SumSize(*(it->second));
+  }
+
+  std::ofstream out(HistoryFileName().c_str(),std::ios::app);
+
+  if (!out)
+  {
+    ERROR() << "Cannot append to history file " << HistoryFileName() << std::endl;
+    return;
+  }
+
+  out << "T " << time(0) << std::endl;
+
+  int nchanged(0);
+
+  for ( AFAggregateMap::const_iterator it = current.begin(); it != current.end(); ++it )
+  {
+    AFAggregate previous;
+
+    if ( last.count(it->first) ) previous = last[it->first];
+
+    if ( it->second.fNFiles != previous.fNFiles || it->second.fSize != previous.fSize )
+    {
+      out << it->second.fNFiles - previous.fNFiles << " " << it->second.fSize - previous.fSize << " " << it->first << std::endl;
+      ++nchanged;
+    }
+  }
+
+  for ( AFAggregateMap::const_iterator it = last.begin(); it != last.end(); ++it )
+  {
+    if ( !current.count(it->first) )
+    {
+      out << -it->second.fNFiles << " " << -it->second.fSize << " " << it->first << std::endl;
+      ++nchanged;
+    }
+  }
+
+  out.close();
+
+  DEBUG(0) << nchanged << " groups changed since previous snapshot" << std::endl;
+}
+
 //______________________________________________________________________________
 std::string AFWebMaker::CSS()
 {
@@ -561,6 +635,180 @@ void AFWebMaker::GenerateDatasetList()
   outfile.close();
 }
 
+//______________________________________________________________________________
+void AFWebMaker::GenerateHistory()
+{
+  /// Generate the trend charts of the occupancy per server, period and user,
+  /// as well as the growth rate (and days to full, if the server capacity is known)
+  /// of each server, from the history file
+
+  DEBUG(2) << "GenerateHistory" << std::endl;
+
+  AFAggregateMap last;
+  std::vector<time_t> times;
+  AFHistorySeries series;
+
+  ReadHistory(last,times,series);
+
+  if ( times.empty() ) return;
+
+  // growth rate of each server, from a least square fit of its occupancy
+  // over the last kTrendWindow days
+  std::map<std::string,double> rates;
+
+  for ( AFHistorySeries::const_iterator it = series.begin(); it != series.end(); ++it )
+  {
+    if ( !BeginsWith(it->first,"SERVER:") ) continue;
+
+    double sx(0), sy(0), sxx(0), sxy(0), n(0);
+
+    for ( std::vector<time_t>::size_type i = 0; i < times.size(); ++i )
+    {
+      double days = difftime(times[i],times.back())/86400.0;
+
+      if ( days < -kTrendWindow ) continue;
+
+      double gb = it->second[i]/byte2GB;
+
+      sx += days; sy += gb; sxx += days*days; sxy += days*gb; n += 1;
+    }
+
+    double denom = n*sxx-sx*sx;
+
+    rates[it->first.substr(7)] = ( n > 1 && denom > 0 ) ? (n*sxy-sx*sy)/denom : 0.0;
+  }
+
+  std::string js = JSGoogleChart();
+
+  js += "function drawChart() {\n";
+
+  const char* categories[] = { "SERVER", "PERIOD", "USER" };
+
+  char buffer[1024];
+
+  for ( int c = 0; c < 3; ++c )
+  {
+    std::string prefix(categories[c]);
+    prefix += ":";
+
+    // keep only the largest (as of the latest snapshot) groups of this category
+    std::vector<std::pair<long long,std::string> > latest;
+
+    for ( AFHistorySeries::const_iterator it = series.begin(); it != series.end(); ++it )
+    {
+      if ( BeginsWith(it->first,prefix) )
+      {
+        latest.push_back(std::make_pair(it->second.back(),it->first));
+      }
+    }
+
+    if ( latest.empty() ) continue;
+
+    std::sort(latest.rbegin(),latest.rend());
+
+    if ( latest.size() > kMaxTrendCurves ) latest.resize(kMaxTrendCurves);
+
+    js += "var data";
+    js += categories[c];
+    js += " = google.visualization.arrayToDataTable([\n['Date'";
+
+    for ( std::vector<std::pair<long long,std::string> >::size_type j = 0; j < latest.size(); ++j )
+    {
+      js += ", '";
+      js += latest[j].second.substr(prefix.size());
+      js += "'";
+    }
+
+    js += "],\n";
+
+    for ( std::vector<time_t>::size_type i = 0; i < times.size(); ++i )
+    {
+      sprintf(buffer,"[new Date(%lld000)",(long long)times[i]);
+      js += buffer;
+
+      for ( std::vector<std::pair<long long,std::string> >::size_type j = 0; j < latest.size(); ++j )
+      {
+        sprintf(buffer,", %7.2f",series[latest[j].second][i]/byte2GB);
+        js += buffer;
+      }
+      js += "],\n";
+    }
+
+    js += "]);\n";
+
+    js += "var chart";
+    js += categories[c];
+    js += " = new google.visualization.LineChart(document.getElementById('trend_";
+    js += categories[c];
+    js += "'));\n";
+    js += "chart";
+    js += categories[c];
+    js += ".draw(data";
+    js += categories[c];
+    js += ",{ title: 'Occupied disk (GB) by ";
+    js += categories[c];
+    js += "', vAxis: { minValue: 0 } });\n";
+  }
+
+  js += "var dataRATE = google.visualization.arrayToDataTable([\n";
+  js += "['Server', 'GB/day'],\n";
+
+  for ( std::map<std::string,double>::const_iterator it = rates.begin(); it != rates.end(); ++it )
+  {
+    sprintf(buffer,"[ '%s', %7.2f ],\n",it->first.c_str(),it->second);
+    js += buffer;
+  }
+
+  js += "]);\n";
+  js += "var chartRATE = new google.visualization.BarChart(document.getElementById('trend_RATE'));\n";
+  sprintf(buffer,"chartRATE.draw(dataRATE,{ title: 'Growth rate (GB/day) by server over the last %.0f days' });\n",kTrendWindow);
+  js += buffer;
+  js += "}\n";
+
+  std::string html = HTMLHeader("History",CSS(),js);
+
+  html += "<div><h1>Disk space usage history on ";
+  html += fHostName;
+  html += "</h1></div>\n";
+
+  html += "<div id=\"trend_RATE\" style=\"width: 1200px; height:500px\"></div>\n";
+
+  html += "<table>\n";
+  html += "<tr><th>Server</th><th>Size (GB)</th><th>Growth (GB/day)</th><th>Days to full</th></tr>\n";
+
+  for ( std::map<std::string,double>::const_iterator it = rates.begin(); it != rates.end(); ++it )
+  {
+    double size = series["SERVER:"+it->first].back()/byte2GB;
+
+    std::string daysToFull("-");
+
+    if ( fServerCapacity > 0 && it->second > 0 )
+    {
+      sprintf(buffer,"%7.0f",std::max(0.0,(fServerCapacity/byte2GB-size)/it->second));
+      daysToFull = buffer;
+    }
+
+    sprintf(buffer,"<tr><td>%s</td><td>%7.2f</td><td>%7.2f</td><td>%s</td></tr>\n",
+            it->first.c_str(),size,it->second,daysToFull.c_str());
+    html += buffer;
+  }
+
+  html += "</table>\n";
+
+  for ( int c = 0; c < 3; ++c )
+  {
+    html += "<div id=\"trend_";
+    html += categories[c];
+    html += "\" style=\"width: 1200px; height:500px\"></div>\n";
+  }
+
+  html += HTMLFooter();
+
+  std::ofstream out(FileNameHistory().c_str());
+  out << html;
+  out.close();
+}
+
 //______________________________________________________________________________
 void AFWebMaker::GeneratePieCharts()
 {
@@ -748,6 +996,15 @@ void AFWebMaker::GenerateReports()
 
   GenerateDataRepartition();
 
+  AppendHistory();
+
+  GenerateHistory();
+
+  if ( fRebalanceTolerance >= 0 )
+  {
+    GenerateRebalancingPlan();
+  }
+
   std::ofstream out("index.html");
 
   std::string html = HTMLHeader(fHostName,CSS(),"");
@@ -776,6 +1033,10 @@ void AFWebMaker::GenerateReports()
   html += FileNameDataRepartition();
   html += "\">Data repartition by server</a>\n";
 
+  html += "<a href=\"";
+  html += FileNameHistory();
+  html += "\">History of disk usage</a>\n";
+
   html += "</nav>\n";
 
   time_t now = time(0);
@@ -794,6 +1055,207 @@ void AFWebMaker::GenerateReports()
   out.close();
 }
 
+//______________________________________________________________________________
+void AFWebMaker::GenerateRebalancingPlan()
+{
+  /// Write (to host.rebalance.sh) the file moves bringing every server within
+  /// fRebalanceTolerance (relative) of the mean occupancy.
+  ///
+  /// Files are moved by whole dataset runs (all the files of one type of one run
+  /// and pass on one server, or all the raw files of one run), so that the PROOF
+  /// packetizer finds them together.
+  /// Each move goes from the most to the least loaded server, and is the largest
+  /// run not overshooting the mean on either side (or, failing that, the smallest
+  /// one still reducing their difference), which keeps the number of bytes moved low.
+  /// Moves are spread over hours so that no server sends plus receives more than
+  /// fRebalanceRate bytes per hour (0 means no limit), the script waiting for each hour to begin.
+  /// The source of a move is only removed once the copy checksum matches.
+
+  DEBUG(2) << "GenerateRebalancingPlan" << std::endl;
+
+  AFFileInfoList& list = FileInfoList();
+
+  GroupMap(); // the runs of the files are decoded there
+
+  // dataset runs of each server
+  std::map<std::string, std::map<std::string, std::vector<const AFFileInfo*> > > units;
+  std::map<std::string, AFFileSize> load;
+  AFFileSize total(0);
+
+  for ( AFFileInfoList::const_iterator it = list.begin(); it != list.end(); ++it )
+  {
+    const AFFileInfo& fi = *it;
+
+    std::map<const AFFileInfo*, std::string>::const_iterator u = fRebalanceUnits.find(&fi);
+
+    std::string unit = ( u != fRebalanceUnits.end() ) ? u->second : ::DirName(fi.fFullPath);
+
+    units[fi.fHostName][unit].push_back(&fi);
+    load[fi.fHostName] += fi.fSize;
+    total += fi.fSize;
+  }
+
+  if ( load.size() < 2 ) return;
+
+  const double mean = total*1.0/load.size();
+  const double upper = mean*(1.0+fRebalanceTolerance);
+  const double lower = mean*(1.0-fRebalanceTolerance);
+
+  std::map<std::string, AFFileSize> before(load);
+
+  std::vector<RebalancingMove> moves;
+  AFFileSize moved(0);
+
+  for (;;)
+  {
+    std::map<std::string, AFFileSize>::const_iterator d = load.begin();
+    std::map<std::string, AFFileSize>::const_iterator r = load.begin();
+
+    for ( std::map<std::string, AFFileSize>::const_iterator it = load.begin(); it != load.end(); ++it )
+    {
+      if ( it->second > d->second ) d = it;
+      if ( it->second < r->second ) r = it;
+    }
+
+    if ( d->second <= upper && r->second >= lower ) break;
+
+    const double gap = d->second*1.0 - r->second;
+    const double noOvershoot = std::min(d->second - mean, mean - r->second);
+
+    std::map<std::string, std::vector<const AFFileInfo*> >& dunits = units[d->first];
+    std::map<std::string, std::vector<const AFFileInfo*> >::iterator best = dunits.end();
+    AFFileSize bestSize(0);
+    bool bestFits(false);
+
+    for ( std::map<std::string, std::vector<const AFFileInfo*> >::iterator u = dunits.begin(); u != dunits.end(); ++u )
+    {
+      AFFileSize size(0);
+
+      for ( std::vector<const AFFileInfo*>::size_type i = 0; i < u->second.size(); ++i )
+      {
+        size += u->second[i]->fSize;
+      }
+
+      if ( size == 0 || size >= gap ) continue;
+
+      bool fits = ( size <= noOvershoot );
+
+      if ( best == dunits.end() ||
+           ( fits && ( !bestFits || size > bestSize ) ) ||
+           ( !fits && !bestFits && size < bestSize ) )
+      {
+        best = u;
+        bestSize = size;
+        bestFits = fits;
+      }
+    }
+
+    if ( best == dunits.end() )
+    {
+      std::cout << "Rebalancing : nothing more can be moved from " << d->first << " to " << r->first << std::endl;
+      break;
+    }
+
+    RebalancingMove move;
+
+    move.fFrom = d->first;
+    move.fTo = r->first;
+    move.fUnit = best->first;
+    move.fFiles = best->second;
+    move.fSize = bestSize;
+
+    moves.push_back(move);
+
+    load[move.fFrom] -= bestSize;
+    load[move.fTo] += bestSize;
+    moved += bestSize;
+
+    // a run is moved at most once
+    dunits.erase(best);
+  }
+
+  // spread the moves over hours
+  std::vector<std::map<std::string, AFFileSize> > traffic;
+  std::map<int, std::vector<RebalancingMove*> > hours;
+
+  for ( std::vector<RebalancingMove>::size_type i = 0; i < moves.size(); ++i )
+  {
+    RebalancingMove& move = moves[i];
+    std::vector<std::map<std::string, AFFileSize> >::size_type h(0);
+
+    for ( ; fRebalanceRate > 0; ++h )
+    {
+      if ( h == traffic.size() ) break;
+
+      AFFileSize from = traffic[h][move.fFrom];
+      AFFileSize to = traffic[h][move.fTo];
+
+      // a run larger than the hourly rate gets an hour of its own
+      if ( ( from == 0 || from + move.fSize <= fRebalanceRate ) &&
+           ( to == 0 || to + move.fSize <= fRebalanceRate ) ) break;
+    }
+
+    if ( h == traffic.size() ) traffic.resize(h+1);
+
+    traffic[h][move.fFrom] += move.fSize;
+    traffic[h][move.fTo] += move.fSize;
+
+    hours[h].push_back(&move);
+  }
+
+  std::string filename(fHostName);
+
+  filename += ".rebalance.sh";
+
+  std::ofstream out(filename.c_str());
+  char buffer[1024];
+
+  out << "#!/bin/sh" << std::endl;
+  sprintf(buffer,"# rebalancing plan for %s : %lu moves, %7.2f GB",fHostName.c_str(),moves.size(),moved/byte2GB);
+  out << buffer << std::endl;
+  out << "START=$(date +%s)" << std::endl;
+
+  for ( std::map<int, std::vector<RebalancingMove*> >::const_iterator h = hours.begin(); h != hours.end(); ++h )
+  {
+    out << "# hour " << h->first << std::endl;
+
+    if ( h->first > 0 )
+    {
+      out << "while [ $(( $(date +%s) - START )) -lt " << h->first*3600 << " ]; do sleep 60; done" << std::endl;
+    }
+
+    for ( std::vector<RebalancingMove*>::size_type i = 0; i < h->second.size(); ++i )
+    {
+      const RebalancingMove& move = *(h->second[i]);
+
+      sprintf(buffer,"echo \"%s (%7.2f GB) %s -> %s\"",move.fUnit.c_str(),move.fSize/byte2GB,move.fFrom.c_str(),move.fTo.c_str());
+      out << buffer << std::endl;
+
+      for ( std::vector<const AFFileInfo*>::size_type f = 0; f < move.fFiles.size(); ++f )
+      {
+        const std::string& path = move.fFiles[f]->fFullPath;
+
+        out << "xrdcp -f --cksum adler32 root://" << move.fFrom << "/" << path << " root://" << move.fTo << "/" << path
+            << " && xrd " << move.fFrom << " rm " << path << std::endl;
+      }
+    }
+  }
+
+  out.close();
+
+  std::cout << "Rebalancing (mean " << mean/byte2GB << " GB, tolerance " << fRebalanceTolerance*100 << " %) :" << std::endl;
+
+  for ( std::map<std::string, AFFileSize>::const_iterator it = load.begin(); it != load.end(); ++it )
+  {
+    sprintf(buffer,"%-40s %8.2f GB -> %8.2f GB",it->first.c_str(),before[it->first]/byte2GB,it->second/byte2GB);
+    std::cout << buffer << std::endl;
+  }
+
+  sprintf(buffer,"%lu runs (%7.2f GB) to move over %lu hour(s), see %s",moves.size(),moved/byte2GB,
+          hours.empty() ? 0ul : 1ul*hours.rbegin()->first+1,filename.c_str());
+  std::cout << buffer << std::endl;
+}
+
 //______________________________________________________________________________
 void AFWebMaker::GenerateTreeMap()
 {
@@ -1183,6 +1645,21 @@ void AFWebMaker::GroupFileInfoList()
 
     }
 
+    if ( runNumber > 0 && fRebalanceTolerance >= 0 && period.size() > 0 )
+    {
+      // raw data files of a run all have different names, and are moved together
+      std::ostringstream unit;
+
+      unit << period << " " << runNumber;
+
+      if ( !strstr(fileInfo.fFullPath.c_str(),"/raw/") )
+      {
+        unit << " " << esdPass << " " << aodPass << " " << fileInfo.Basename();
+      }
+
+      fRebalanceUnits[&fileInfo] = unit.str();
+    }
+
     if ( runNumber > 0 )
     {
       std::ostringstream os;
@@ -1308,6 +1785,17 @@ std::string AFWebMaker::HTMLHeader(const std::string& title, const std::string&
   return header;
 }
 
+//______________________________________________________________________________
+std::string AFWebMaker::HistoryFileName() const
+{
+  if ( !fHistoryFile.empty() ) return fHistoryFile;
+
+  std::string name(fHostName);
+
+  name += ".history.txt";
+
+  return name;
+}
 
 //______________________________________________________________________________
 std::string AFWebMaker::JSGoogleChart(const std::string& chartPackage) const
@@ -1389,6 +1877,61 @@ std::string AFWebMaker::OutputHtmlFileName(const std::string& type) const
   return name;
 }
 
+//______________________________________________________________________________
+void AFWebMaker::ReadHistory(AFAggregateMap& last, std::vector<time_t>& times, AFHistorySeries& series) const
+{
+  /// Replay the history file (see AppendHistory) to get the last group aggregates,
+  /// as well as the time series of the size of the SERVER, PERIOD and USER groups
+  /// (one value per snapshot time)
+
+  last.clear();
+  times.clear();
+  series.clear();
+
+  std::ifstream in(HistoryFileName().c_str());
+  std::string line;
+
+  while ( getline(in,line) )
+  {
+    if ( BeginsWith(line,"T ") )
+    {
+      times.push_back(atol(line.c_str()+2));
+    }
+    else if ( !times.empty() )
+    {
+      std::istringstream sin(line);
+      AFAggregate delta;
+      std::string group;
+
+      sin >> delta.fNFiles >> delta.fSize;
+      getline(sin >> std::ws,group);
+
+      if ( group.empty() ) continue;
+
+      AFAggregate& agg = last[group];
+      agg.fNFiles += delta.fNFiles;
+      agg.fSize += delta.fSize;
+
+      if ( BeginsWith(group,"SERVER:") || BeginsWith(group,"PERIOD:") || BeginsWith(group,"USER:") )
+      {
+        std::vector<long long>& v = series[group];
+        v.resize(times.size(),v.empty() ? 0 : v.back());
+        v.back() = agg.fSize;
+      }
+
+      if ( agg.fNFiles == 0 && agg.fSize == 0 ) last.erase(group);
+    }
+  }
+
+  // unchanged groups keep their value up to the last snapshot
+  for ( AFHistorySeries::iterator it = series.begin(); it != series.end(); ++it )
+  {
+    it->second.resize(times.size(),it->second.back());
+  }
+
+  DEBUG(1) << "Read " << times.size() << " snapshots from " << HistoryFileName() << std::endl;
+}
+
 //_________________________________________________________________________________________________
 AFWebMaker::AFFileSize AFWebMaker::SumSize(const AFFileInfoList& list) const
 {
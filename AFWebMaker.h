@@ -37,6 +37,32 @@ public:
   typedef std::list<AFFileInfo> AFFileInfoList;
   typedef std::map<std::string, AFFileInfoList*> AFFileInfoMap;
   
+  class AFAggregate
+  {
+  public:
+    AFAggregate() : fNFiles(0), fSize(0) {}
+    
+  public:
+    long long fNFiles;
+    long long fSize;
+  };
+  
+  typedef std::map<std::string, AFAggregate> AFAggregateMap;
+  typedef std::map<std::string, std::vector<long long> > AFHistorySeries;
+  
+  class RebalancingMove
+  {
+  public:
+    RebalancingMove() : fFrom(), fTo(), fUnit(), fFiles(), fSize(0) {}
+    
+  public:
+    std::string fFrom;
+    std::string fTo;
+    std::string fUnit; // dataset run moved
+    std::vector<const AFFileInfo*> fFiles;
+    AFFileSize fSize;
+  };
+  
   AFWebMaker(const std::string& topdir, const std::string& fileListPattern, const std::string& prefix,
              int debuglevel=0);
   ~AFWebMaker();
@@ -47,10 +73,18 @@ public:
   
   static void SetGlobalDebugLevel(int level) { fgDebugLevel = level; }
   
+  void SetHistoryFile(const std::string& filename) { fHistoryFile = filename; }
+  
+  void SetServerCapacity(AFFileSize capacity) { fServerCapacity = capacity; }
+  
+  void SetRebalancing(double tolerance, AFFileSize bytesPerHour) { fRebalanceTolerance = tolerance; fRebalanceRate = bytesPerHour; }
+  
 private:
   
   void AddFileToGroup(const std::string& file, const AFWebMaker::AFFileInfo& fileInfo);
 
+  void AppendHistory();
+
   static std::string CSS();
 
   int DecodePath(const std::string& path, std::string& period,
@@ -61,6 +95,7 @@ private:
   std::string FileNameTreeMap() const { return OutputHtmlFileName("treemap"); }
   std::string FileNameDataSetList() const { return OutputHtmlFileName("datasetlist"); }
   std::string FileNameDataRepartition() const { return OutputHtmlFileName("datarepartition"); }
+  std::string FileNameHistory() const { return OutputHtmlFileName("history"); }
   
   void FillFileInfoMap(const std::string& worker="");
 
@@ -76,8 +111,12 @@ private:
   
   void GenerateDatasetList();
   
+  void GenerateHistory();
+  
   void GeneratePieCharts();
   
+  void GenerateRebalancingPlan();
+  
   void GenerateTreeMap();
   
   void GetFileInfoMap();
@@ -90,6 +129,8 @@ private:
 
   void GroupFileInfoList();
 
+  std::string HistoryFileName() const;
+
   static std::string HTMLHeader(const std::string& title, const std::string& css, const std::string& js);
 
   static std::string HTMLFooter(bool withJS=false);
@@ -102,6 +143,8 @@ private:
   
   std::string OutputHtmlFileName(const std::string& type) const;
 
+  void ReadHistory(AFAggregateMap& last, std::vector<time_t>& times, AFHistorySeries& series) const;
+
   AFFileSize SumSize(const AFFileInfoList& list) const;
   
 private:
@@ -113,6 +156,11 @@ private:
   AFFileInfoList fFileInfoList;
   AFFileInfoMap fGroupMap;
   int fDebugLevel;
+  std::string fHistoryFile; // file where the group aggregates of each run are appended
+  AFFileSize fServerCapacity; // disk capacity of one server (0 if unknown)
+  double fRebalanceTolerance; // relative distance to the mean occupancy allowed for each server (<0 for no rebalancing plan)
+  AFFileSize fRebalanceRate; // max bytes sent plus received by one server per hour when rebalancing (0 for no limit)
+  std::map<const AFFileInfo*, std::string> fRebalanceUnits; // dataset run of each file, as decoded by GroupFileInfoList (when rebalancing)
   
   static int fgDebugLevel;
 
@@ -6,19 +6,391 @@
 #include "TSystem.h"
 #include <iostream>
 #include "TFile.h"
+#include "TFileCollection.h"
+#include "TFileInfo.h"
+#include "TMD5.h"
+#include "AFParallel.h"
+#include "TZIPFile.h"
+#include "TZIPMember.h"
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
-void CopyFromRemote(const char* txtfile)
+namespace
+{
+  typedef std::chrono::steady_clock Clock;
+
+  // maximum delay between two attempts of the same copy
+  const int kMaxBackoff(60);
+
+  // how often the progress is reported
+  const int kProgressPeriod(10);
+
+  // size of the pieces read from the remote files
+  const Int_t kChunkSize(8*1024*1024);
+
+  struct CopyJob
+  {
+    CopyJob() : fUrl(), fSize(-1), fMD5(), fFile(), fHost(), fMember(), fArchive(false), fAttempts(0), fNotBefore(Clock::now()) {}
+
+    std::string fUrl; // source
+    Long64_t fSize; // expected size of the source (-1 if unknown)
+    std::string fMD5; // expected md5 of the source (empty if unknown)
+    std::string fFile; // local destination (the archive path, next to which its members go, for a whole archive)
+    std::string fHost; // host the source is read from
+    std::string fMember; // archive member to extract (if any)
+    bool fArchive; // whether to extract (all or fMember) from the zip archive fUrl
+    int fAttempts; // number of copies tried so far
+    Clock::time_point fNotBefore; // do not retry before that time
+  };
+
+  Long64_t ExtractMember(TFile& archive, const TZIPMember& member, const TString& output)
+  {
+    /// Read (only) the given member from the zip archive and write it (inflated if needed)
+    /// to output. Return the number of bytes written, or -1 if anything went wrong,
+    /// including a size or crc32 not matching the zip central directory.
+
+    if ( member.GetMethod() != 0 && member.GetMethod() != Z_DEFLATED )
+    {
+      std::cout << "Unsupported compression method " << member.GetMethod() << " for " << member.GetName() << std::endl;
+      return -1;
+    }
+
+    TString part(output + ".part");
+    std::ofstream out(part.Data(),std::ios::binary);
+    std::vector<char> in(kChunkSize);
+    std::vector<char> inflated(member.GetMethod() ? kChunkSize : 0);
+    z_stream zs;
+    Long64_t nread(0);
+    Long64_t nwritten(0);
+    uLong crc = crc32(0L,Z_NULL,0);
+    bool ok(true);
+
+    if ( member.GetMethod() )
+    {
+      zs.zalloc = Z_NULL;
+      zs.zfree = Z_NULL;
+      zs.opaque = Z_NULL;
+      zs.avail_in = 0;
+      zs.next_in = Z_NULL;
+      // zip entries are raw deflate streams (no zlib header)
+      ok = ( inflateInit2(&zs,-MAX_WBITS) == Z_OK );
+    }
+
+    while ( ok && nread < member.GetCompressedSize() )
+    {
+      Int_t n = static_cast<Int_t>(std::min<Long64_t>(kChunkSize,member.GetCompressedSize()-nread));
+
+      // ReadBuffer returns kTRUE in case of failure
+      if ( archive.ReadBuffer(&in[0],member.GetFilePosition()+nread,n) )
+      {
+        ok = false;
+        break;
+      }
+
+      nread += n;
+
+      if ( !member.GetMethod() )
+      {
+        crc = crc32(crc,reinterpret_cast<Bytef*>(&in[0]),n);
+        out.write(&in[0],n);
+        nwritten += n;
+        continue;
+      }
+
+      zs.next_in = reinterpret_cast<Bytef*>(&in[0]);
+      zs.avail_in = n;
+
+      do
+      {
+        zs.next_out = reinterpret_cast<Bytef*>(&inflated[0]);
+        zs.avail_out = inflated.size();
+
+        int rv = inflate(&zs,Z_NO_FLUSH);
+
+        // no progress possible : the output buffer was exactly filled by the end
+        // of the current input, so it is just a matter of reading more
+        if ( rv == Z_BUF_ERROR ) break;
+
+        if ( rv != Z_OK && rv != Z_STREAM_END )
+        {
+          ok = false;
+          break;
+        }
+
+        uInt m = inflated.size() - zs.avail_out;
+
+        crc = crc32(crc,reinterpret_cast<Bytef*>(&inflated[0]),m);
+        out.write(&inflated[0],m);
+        nwritten += m;
+      } while ( zs.avail_out == 0 );
+    }
+
+    if ( member.GetMethod() ) inflateEnd(&zs);
+
+    out.close();
+
+    if ( ok && ( !out || nwritten != member.GetDecompressedSize() || crc != member.GetCRC32() ) )
+    {
+      std::cout << "Size or checksum mismatch for " << member.GetName() << std::endl;
+      ok = false;
+    }
+
+    if ( !ok || gSystem->Rename(part.Data(),output.Data()) )
+    {
+      gSystem->Unlink(part.Data());
+      return -1;
+    }
+
+    return nwritten;
+  }
+
+  Long64_t CopyInChunks(const CopyJob& job)
+  {
+    /// Copy job.fUrl to job.fFile.part, in pieces, starting from the end of what
+    /// an earlier (interrupted) attempt left there, then check its size and md5
+    /// (when known) and rename it to job.fFile. A .part failing the checks is removed.
+    /// Return the number of bytes transferred, or -1 in case of failure.
+
+    TUrl url(job.fUrl.c_str());
+    TString opt(url.GetOptions());
+
+    if ( opt.Length() ) opt += "&";
+    opt += "filetype=raw";
+    url.SetOptions(opt.Data());
+
+    std::unique_ptr<TFile> file(TFile::Open(url.GetUrl()));
+
+    if (!file)
+    {
+      std::cout << "Cannot open " << job.fUrl << std::endl;
+      return -1;
+    }
+
+    Long64_t size = file->GetSize();
+
+    if ( job.fSize >= 0 && size != job.fSize )
+    {
+      std::cout << job.fUrl << " is " << size << " bytes instead of " << job.fSize << " in the catalog" << std::endl;
+      return -1;
+    }
+
+    TString part(Form("%s.part",job.fFile.c_str()));
+    FileStat_t st;
+    Long64_t offset(0);
+
+    if ( gSystem->GetPathInfo(part.Data(),st) == 0 )
+    {
+      offset = st.fSize;
+
+      if ( offset > size )
+      {
+        gSystem->Unlink(part.Data());
+        offset = 0;
+      }
+    }
+
+    std::ofstream out(part.Data(),std::ios::binary | std::ios::app);
+    std::vector<char> buffer(kChunkSize);
+    const Long64_t start(offset);
+
+    while ( offset < size && out )
+    {
+      Int_t n = static_cast<Int_t>(std::min<Long64_t>(kChunkSize,size-offset));
+
+      // ReadBuffer returns kTRUE in case of failure : keep what we have for the next attempt
+      if ( file->ReadBuffer(&buffer[0],offset,n) ) return -1;
+
+      out.write(&buffer[0],n);
+      out.flush();
+      offset += n;
+    }
+
+    out.close();
+
+    if ( !out || gSystem->GetPathInfo(part.Data(),st) || st.fSize != size )
+    {
+      std::cout << "Size mismatch for " << part.Data() << std::endl;
+      gSystem->Unlink(part.Data());
+      return -1;
+    }
+
+    if ( !job.fMD5.empty() )
+    {
+      std::unique_ptr<TMD5> md5(TMD5::FileChecksum(part.Data()));
+
+      if ( !md5 || job.fMD5 != md5->AsString() )
+      {
+        std::cout << "Checksum mismatch for " << part.Data() << std::endl;
+        gSystem->Unlink(part.Data());
+        return -1;
+      }
+    }
+
+    if ( gSystem->Rename(part.Data(),job.fFile.c_str()) ) return -1;
+
+    return size - start;
+  }
+
+  void ReadSources(const char* input, std::vector<CopyJob>& sources)
+  {
+    /// Get the urls to copy, and their expected size and md5 if available, either
+    /// from a dataset (a TFileCollection named "dataset" in a .root file)
+    /// or from a text file (one "url [size [md5]]" per line)
+
+    TString sinput(input);
+
+    gSystem->ExpandPathName(sinput);
+
+    if ( sinput.EndsWith(".root") )
+    {
+      std::unique_ptr<TFile> file(TFile::Open(sinput.Data()));
+      std::unique_ptr<TFileCollection> fc(file ? static_cast<TFileCollection*>(file->Get("dataset")) : 0x0);
+
+      if (!fc)
+      {
+        std::cout << "Cannot read dataset from " << sinput.Data() << std::endl;
+        return;
+      }
+
+      TIter next(fc->GetList());
+      TFileInfo* fi;
+
+      while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+      {
+        CopyJob source;
+
+        source.fUrl = fi->GetFirstUrl()->GetUrl();
+        source.fSize = fi->GetSize() > 0 ? fi->GetSize() : -1;
+        if ( fi->GetMD5() ) source.fMD5 = fi->GetMD5()->AsString();
+        sources.push_back(source);
+      }
+      return;
+    }
+
+    std::ifstream in(sinput.Data());
+    std::string line;
+
+    while ( std::getline(in,line) )
+    {
+      std::istringstream sline(line);
+      CopyJob source;
+
+      if (!(sline >> source.fUrl)) continue;
+
+      Long64_t size;
+
+      if ( sline >> size ) source.fSize = size;
+      sline >> source.fMD5;
+      sources.push_back(source);
+    }
+  }
+
+  Long64_t ExtractFromArchive(const CopyJob& job)
+  {
+    /// Extract job.fMember (or all the members if empty) of the remote zip archive
+    /// job.fUrl into the local directory of the archive, reading the archive in place :
+    /// only its central directory and the wanted members are transferred.
+    /// Members already there with the right size are not extracted again.
+    /// Return the number of bytes written, or -1 in case of failure.
+
+    TUrl url(job.fUrl.c_str());
+    TString opt(url.GetOptions());
+
+    // read the archive as a plain sequence of bytes
+    if ( opt.Length() ) opt += "&";
+    opt += "filetype=raw";
+    url.SetOptions(opt.Data());
+
+    std::unique_ptr<TFile> file(TFile::Open(url.GetUrl()));
+
+    if (!file)
+    {
+      std::cout << "Cannot open " << job.fUrl << std::endl;
+      return -1;
+    }
+
+    TZIPFile zip(job.fUrl.c_str(),job.fMember.c_str(),file.get());
+
+    if ( zip.OpenArchive() )
+    {
+      std::cout << "Cannot read the zip directory of " << job.fUrl << std::endl;
+      return -1;
+    }
+
+    TString dir(gSystem->DirName(url.GetFile()));
+    Long64_t bytes(0);
+
+    for ( Int_t i = 0; i < zip.GetNumberOfMembers(); ++i )
+    {
+      const TZIPMember* member = static_cast<const TZIPMember*>(zip.GetMembers()->At(i));
+      TString name(member->GetName());
+
+      if ( !job.fMember.empty() && name != job.fMember.c_str() ) continue;
+
+      TString output(Form("%s/%s",dir.Data(),name.Data()));
+
+      if ( name.EndsWith("/") )
+      {
+        gSystem->mkdir(output.Data(),kTRUE);
+        continue;
+      }
+
+      FileStat_t st;
+
+      if ( gSystem->GetPathInfo(output.Data(),st) == 0 && st.fSize == member->GetDecompressedSize() ) continue;
+
+      gSystem->mkdir(gSystem->DirName(output.Data()),kTRUE);
+
+      // this reads the member local header, hence its actual position in the archive
+      if ( zip.SetMember(i) )
+      {
+        std::cout << "Cannot locate " << name.Data() << " in " << job.fUrl << std::endl;
+        return -1;
+      }
+
+      Long64_t n = ExtractMember(*file,*static_cast<const TZIPMember*>(zip.GetMember()),output);
+
+      if ( n < 0 ) return -1;
+
+      bytes += n;
+
+      if ( !job.fMember.empty() ) return bytes;
+    }
+
+    if ( !job.fMember.empty() )
+    {
+      std::cout << job.fMember << " not found in " << job.fUrl << std::endl;
+      return -1;
+    }
+
+    return bytes;
+  }
+}
+
+void CopyFromRemote(const char* txtfile, int nthreads, int maxPerHost, int maxRetries)
 {
   /// Copy a list of remote urls locally, keeping the absolute path
   /// (the destination local directory must exist and be writeable, of course)
-  
-  char line[1024];
-  std::ifstream in(gSystem->ExpandPathName(txtfile));
-  
-  while ( in.getline(line,1024,'\n') )
+
+  std::vector<CopyJob> sources;
+  std::vector<CopyJob> pending;
+
+  ReadSources(txtfile,sources);
+
+  for ( std::vector<CopyJob>::const_iterator it = sources.begin(); it != sources.end(); ++it )
   {
-  	TUrl url(line);
-  	
+  	TUrl url(it->fUrl.c_str());
+
     if ( TString(url.GetProtocol()) == "alien" )
     {
       if (!gGrid)
@@ -30,37 +402,218 @@ void CopyFromRemote(const char* txtfile)
           return;
         }
       }
-      
+
     }
-  
+
   	TString file(url.GetFile());
-  
-//    file.ReplaceAll("/alice","/home/laphecet/data/alice");	
+    TString member(url.GetAnchor());
+    CopyJob job(*it);
+
+    if ( member.Length() )
+    {
+      // only the member will be extracted, next to where the archive would be
+      url.SetAnchor("");
+      job.fUrl = url.GetUrl();
+      file = gSystem->DirName(file.Data());
+      file += "/";
+      file += member;
+    }
+
+//    file.ReplaceAll("/alice","/home/laphecet/data/alice");
 //    file.ReplaceAll("/PWG3","/home/laphecet/PWG3");
 
   	TString dir(gSystem->DirName(file));
-  	
+
   	gSystem->mkdir(dir.Data(),kTRUE);
-    
-    if ( gSystem->AccessPathName(file.Data())==kFALSE)
+
+    // (the members of a whole archive are only known when reading it ;
+    // an interrupted copy is in file.part, so file only exists once complete)
+    if ( ( member.Length() || !file.EndsWith(".zip") ) && gSystem->AccessPathName(file.Data())==kFALSE)
     {
             std::cout << "Skipping copy of " << file.Data() << " as it already exists\n";
+      continue;
     }
-    else
+
+    job.fFile = file.Data();
+    job.fHost = url.GetHost();
+    job.fArchive = ( file.EndsWith(".zip") || member.Length() );
+    job.fMember = member.Data();
+
+    pending.push_back(job);
+  }
+
+  // no two jobs may write the same destination at the same time : drop the duplicated
+  // urls, and the members of archives which are extracted as a whole anyway
+  std::set<std::string> wholeArchives;
+
+  for ( std::vector<CopyJob>::const_iterator it = pending.begin(); it != pending.end(); ++it )
+  {
+    if ( it->fArchive && it->fMember.empty() ) wholeArchives.insert(it->fFile);
+  }
+
+  std::set<std::string> destinations;
+  std::vector<CopyJob> unique;
+
+  for ( std::vector<CopyJob>::const_iterator it = pending.begin(); it != pending.end(); ++it )
+  {
+    if ( !it->fMember.empty() && wholeArchives.count(TUrl(it->fUrl.c_str()).GetFile()) )
+    {
+      std::cout << "Skipping " << it->fMember << " of " << it->fUrl << " as the whole archive is extracted" << std::endl;
+      continue;
+    }
+
+    if ( !destinations.insert(it->fFile).second )
     {
-      std::cout << "TFile::Cp(" << line << "," << file.Data() << ")" << std::endl;
-  	  TFile::Cp(line,file.Data());
-      if ( TString(line).Remove(TString::kTrailing,' ').EndsWith("zip") )
+      std::cout << "Skipping " << it->fUrl << " as it is already listed" << std::endl;
+      continue;
+    }
+
+    unique.push_back(*it);
+  }
+
+  pending.swap(unique);
+
+  const std::vector<CopyJob>::size_type ntotal = pending.size();
+
+  if (!ntotal) return;
+
+  nthreads = std::max(nthreads,1);
+  maxPerHost = std::max(maxPerHost,1);
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::map<std::string,int> active;
+  int nactive(0);
+  std::vector<CopyJob>::size_type ndone(0);
+  std::vector<CopyJob>::size_type nfailed(0);
+  Long64_t bytes(0);
+  const Clock::time_point start = Clock::now();
+
+  AFParallel::EnableThreadSafety();
+
+  std::thread progress([&]()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while ( ndone + nfailed < ntotal )
+    {
+      changed.wait_for(lock,std::chrono::seconds(kProgressPeriod));
+
+      double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+      if ( ndone == 0 || elapsed <= 0 ) continue;
+
+      double eta = elapsed*(ntotal-ndone-nfailed)/(ndone+nfailed);
+
+      std::cout << Form("%lu/%lu files copied (%lu failed) %7.2f GB %7.2f MB/s ETA %02d:%02d:%02d",
+                        ndone,ntotal,nfailed,bytes/1024.0/1024.0/1024.0,bytes/1024.0/1024.0/elapsed,
+                        static_cast<int>(eta)/3600,(static_cast<int>(eta)%3600)/60,static_cast<int>(eta)%60)
+                << std::endl;
+    }
+  });
+
+  // each thread takes the first copy whose host is not saturated and whose backoff is over
+  AFParallel::ForEach(nthreads,nthreads,[&](std::size_t)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while ( !pending.empty() || nactive > 0 )
+    {
+      std::vector<CopyJob>::iterator j = pending.end();
+      Clock::time_point next = Clock::time_point::max();
+      Clock::time_point now = Clock::now();
+
+      for ( std::vector<CopyJob>::iterator it = pending.begin(); it != pending.end() && j == pending.end(); ++it )
       {
-        gSystem->Exec(Form("unzip %s -d %s",file.Data(),gSystem->DirName(file.Data())));
-        gSystem->Exec(Form("rm %s",file.Data()));
+        // (alien urls have no host : the storage actually read is not known in advance)
+        if ( !it->fHost.empty() && active[it->fHost] >= maxPerHost ) continue;
+
+        if ( it->fNotBefore > now )
+        {
+          next = std::min(next,it->fNotBefore);
+          continue;
+        }
+
+        j = it;
       }
-      if (strlen(url.GetAnchor())>0)
+
+      if ( j == pending.end() )
       {
-        gSystem->Exec(Form("unzip %s %s -d %s",file.Data(),url.GetAnchor(),gSystem->DirName(file.Data())));
-        gSystem->Exec(Form("rm %s",file.Data()));
+        if ( next == Clock::time_point::max() )
+        {
+          changed.wait(lock);
+        }
+        else
+        {
+          changed.wait_until(lock,next);
+        }
+        continue;
       }
-  	}
-  }
-}
 
+      CopyJob job = *j;
+
+      pending.erase(j);
+      ++active[job.fHost];
+      ++nactive;
+      ++job.fAttempts;
+
+      if ( job.fArchive )
+      {
+        std::cout << "Extracting " << ( job.fMember.empty() ? "all" : job.fMember.c_str() ) << " from " << job.fUrl << std::endl;
+      }
+      else
+      {
+        std::cout << "Copying " << job.fUrl << " to " << job.fFile << std::endl;
+      }
+
+      lock.unlock();
+
+      Long64_t size(-1);
+
+      if ( job.fArchive )
+      {
+        size = ExtractFromArchive(job);
+      }
+      else
+      {
+        size = CopyInChunks(job);
+      }
+
+      Bool_t ok = ( size >= 0 );
+
+      lock.lock();
+
+      --active[job.fHost];
+      --nactive;
+
+      if (ok)
+      {
+        ++ndone;
+        bytes += size;
+      }
+      else if ( job.fAttempts <= maxRetries )
+      {
+        int delay = std::min(kMaxBackoff,1 << job.fAttempts);
+
+        std::cout << "Copy of " << job.fUrl << " failed, will retry in " << delay << " s" << std::endl;
+        job.fNotBefore = Clock::now() + std::chrono::seconds(delay);
+        pending.push_back(job);
+      }
+      else
+      {
+        std::cout << "Copy of " << job.fUrl << " failed " << job.fAttempts << " times, giving up" << std::endl;
+        ++nfailed;
+      }
+
+      changed.notify_all();
+    }
+  });
+
+  progress.join();
+
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::cout << Form("%lu/%lu files copied (%lu failed) %7.2f GB in %.0f s (%7.2f MB/s)",
+                    ndone,ntotal,nfailed,bytes/1024.0/1024.0/1024.0,elapsed,
+                    elapsed > 0 ? bytes/1024.0/1024.0/elapsed : 0.0) << std::endl;
+}
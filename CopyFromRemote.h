@@ -1,6 +1,11 @@
 #ifndef COPYFROMREMOTE_H
 #define COPYFROMREMOTE_H
 
-void CopyFromRemote(const char* txtfile);
+/// Copy the urls listed in txtfile (one "url [size [md5]]" per line, or a .root
+/// file with a TFileCollection named "dataset") locally (keeping their absolute path),
+/// with up to nthreads copies at the same time, but no more than maxPerHost
+/// from the same host. Failed copies are retried (up to maxRetries times)
+/// after an increasing delay, and resume from where they stopped.
+void CopyFromRemote(const char* txtfile, int nthreads=1, int maxPerHost=2, int maxRetries=3);
 
 #endif
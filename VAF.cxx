@@ -1,6 +1,8 @@
 #include "VAF.h"
 
+#include "AFParallel.h"
 #include "AFWebMaker.h"
+#include "CopyFromRemote.h"
 #include "Riostream.h"
 #include "TClass.h"
 #include "TCollection.h"
@@ -32,1806 +34,4368 @@
 #include <list>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include "TMath.h"
 #include "TRandom3.h"
 #include "TKey.h"
+#include "TBasket.h"
+#include "TBranch.h"
+#include "TMD5.h"
+#include "RZip.h"
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
 #include <memory>
+#include <mutex>
 
 namespace
 {
   Double_t byte2GB(1024*1024*1024);
   Double_t byte2MB(1024*1024);
   
-}
-using namespace std;
-
-//______________________________________________________________________________
-VAF::VAF(const char* master) : fConnect(""), fDryRun(kTRUE), fMergedOnly(kTRUE),
-fSimpleRunNumbers(kFALSE), fFilterName(""), fMaster(master),
-fHomeDir(""),fLogDir(""), fFileTypeToLookFor('f'), fAliPhysics(""), fForceUpdate(kFALSE)
-{
-  if ( TString(master) != "unknown" )
-  {
-    fConnect = master;
-    fConnect += "/?N";
-  }
-  
-//  std::cout << "Connect string to be used = " << fConnect.Data() << std::endl;
-}
-
-//______________________________________________________________________________
-Int_t VAF::CheckOneDataSet(const char* dsname)
-{
-  std::ofstream out("check-one-dataset.sh");
-  
-  Int_t rv = CheckOneDataSet(dsname,out);
-  
-  out.close();
-
-  return rv;
-}
-
-//______________________________________________________________________________
-Int_t VAF::CheckOneDataSet(const char* dsname, std::ofstream& out)
-{
-  /// Check one data set
-  /// The check itself is handled by the TestROOTFile method
-  /// Return the number of bad files, and put their names
-  /// in the badFiles map
+  // maximum number of files (per worker) a single find command of GenerateReports
+  // should return, to stay well below the size limit of the macro log
+  const Long64_t kScanChunkCost(50000);
   
-  if (!Connect()) return -1;
+  // depth (counted from the top of the data pool) of the subtrees GenerateReports
+  // distributes among its find commands, e.g. /alice/data/2015/LHC15o
+  const std::string::size_type kScanDepth(4);
   
-  std::cout << "Testing dataset " << dsname << " ... " << std::endl;
+  // file where GenerateReports keeps the number of files found per subtree
+  const char* kScanCostFile("scan-costs.txt");
   
-  TFileCollection* fc = gProof->GetDataSet(dsname);
+  // maximum number of subtrees, and of characters of their paths, given to a single
+  // find command of GenerateReports (to stay well below the command line size limit)
+  const std::vector<std::string>::size_type kScanChunkMaxDirs(500);
+  const std::string::size_type kScanChunkMaxLength(32000);
   
-  if (!fc)
+  struct ScanChunk
   {
-    std::cout << "cannot get dataset " << dsname << std::endl;
-    return -2;
-  }
-  else
+    ScanChunk() : fCost(0), fLength(0), fDirs() {}
+    
+    Long64_t fCost; // expected number of files (per worker)
+    std::string::size_type fLength; // total length of the paths of fDirs
+    std::vector<std::string> fDirs; // subtrees to be scanned by one find command
+  };
+  
+  bool LargerCost(const ScanChunk& a, const ScanChunk& b)
   {
-    std::cout << "Scanning " << fc->GetList()->GetLast() << " files" << std::endl;
+    return a.fCost > b.fCost;
   }
-  TIter next(fc->GetList());
-  TFileInfo* fi;
-  Int_t nbad(0);
-  TString treeName(fc->GetDefaultTreeName());
-  treeName.ReplaceAll("/","");
   
-  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  std::string ScanSubtree(const std::string& path)
   {
-    TUrl url(*(fi->GetFirstUrl()));
-    std::string filename(url.GetUrl());
+    /// Return the kScanDepth first components of path (or an empty string
+    /// if path is not deep enough to belong to a subtree)
     
-    if (!fi->TestBit(TFileInfo::kStaged) || fi->TestBit(TFileInfo::kCorrupted)) continue;
+    std::string::size_type pos(0);
     
-    int rv = TestROOTFile(filename.c_str(),treeName.Data());
-
-    if (rv<0)
-    {
-      
-      out << Form("echo \"xrd %s rm %s\"",url.GetHost(),url.GetFile()) << std::endl;
-      
-      out << "xrd " << url.GetHost() << " rm " << url.GetFile() << std::endl;      ++nbad;
-      
-    }
-  }
-  
-  std::cout << "nad=" << nbad << std::endl;
-  
-  return nbad;
-}
-
-//______________________________________________________________________________
-void VAF::ClearPackages()
-{
-  if ( Connect() )
-  {
-    gProof->ClearPackages();
-  }
-}
-
-//______________________________________________________________________________
-void VAF::UpdateConnectString()
-{
-  if ( fConnect.Contains("@")) return;
-
-  if ( fConnect.Contains("pod") ) 
-{
-fConnect="pod://";
-return;
-}  
-  std::ifstream in(Form("/tmp/gclient_token_%d",gSystem->GetUid()));
-  TString s;
-  TString user;
-  while (s.ReadLine(in))
-  {
-    if (s.BeginsWith("User"))
+    for ( std::string::size_type i = 0; i < kScanDepth; ++i )
     {
-      TObjArray* a = s.Tokenize('=');
-      user = static_cast<TObjString*>(a->Last())->String();
-      user = user(1,user.Length()-1);
-      delete a;
-      break;
+      pos = path.find('/',pos+1);
+      if ( pos == std::string::npos ) return "";
     }
+    
+    return path.substr(0,pos);
   }
-  if (user.Length())
-  {
-    TString tmp = fConnect;
-    fConnect = user;
-    fConnect += "@";
-    fConnect += tmp;
-  }
-}
-
-
-//______________________________________________________________________________
-Bool_t VAF::Connect(const char* option)
-{
-  // FIXME: how to tell, for an existing connection, which option was used ?
-  
-  if ( gProof ) return kTRUE;
-  
-  if ( fConnect.Length()==0 ) return kFALSE;
-  
-  UpdateConnectString();
-  
-  TProof::Open(fConnect.Data(),option);
-  
-  return (gProof != 0x0);
-}
-
-//______________________________________________________________________________
-void VAF::CompareRunLists(const char* runlist1, const char* runlist2)
-{
-  std::vector<int> v1, v2;
-  
-  ReadIntegers(runlist1,v1);
-  ReadIntegers(runlist2,v2);
-  
-  cout << "Only in v1:" << endl;
-  
-  int n(0);
   
-  for ( std::vector<int>::size_type i = 0; i < v1.size(); ++i )
+  void ReadScanCosts(std::map<std::string,Long64_t>& costs)
   {
-    int run = v1[i];
-    std::vector<int>::const_iterator it = std::find(v2.begin(),v2.end(),run);
-    if ( it == v2.end() )
+    std::ifstream in(kScanCostFile);
+    std::string dir;
+    Long64_t n;
+    
+    while ( in >> dir >> n )
     {
-      cout << run << endl;
-      ++n;
+      costs[dir] = n;
     }
   }
-  cout << n << " runs" << endl;
-  
-  n = 0;
   
-  cout << "Only in v2:" << endl;
-  for ( std::vector<int>::size_type i = 0; i < v2.size(); ++i )
+  void WriteScanCosts(const std::map<std::string,Long64_t>& costs)
   {
-    int run = v2[i];
-    std::vector<int>::const_iterator it = std::find(v1.begin(),v1.end(),run);
-    if ( it == v1.end() )
+    std::ofstream out(kScanCostFile);
+    
+    for ( std::map<std::string,Long64_t>::const_iterator it = costs.begin(); it != costs.end(); ++it )
     {
-      cout << run << endl;
-      ++n;
+      out << it->first << " " << it->second << std::endl;
     }
   }
-  cout << n << " runs" << endl;
-  
-}
-
-
-//______________________________________________________________________________
-void VAF::CopyFromRemote(const char* txtfile)
-{
-  /// Copy a list of remote urls locally, keeping the absolute path
-  /// (the destination local directory must exist and be writeable, of course)
   
-  char line[1024];
-  ifstream in(gSystem->ExpandPathName(txtfile));
-  
-  while ( in.getline(line,1024,'\n') )
+  void PartitionScan(const std::set<std::string>& subtrees,
+                     const std::map<std::string,Long64_t>& costs,
+                     Int_t nworkers,
+                     std::vector<ScanChunk>& chunks)
   {
-  	TUrl url(line);
-  	
-    if ( TString(url.GetProtocol()) == "alien" )
+    /// Distribute the subtrees into chunks of roughly equal cost, using the
+    /// number of files each subtree had in the previous scan. Subtrees are
+    /// placed largest first, each one into the currently cheapest chunk that
+    /// still has room (see kScanChunkMaxDirs and kScanChunkMaxLength), a new chunk
+    /// being added if none has. Subtrees unknown to the previous scan get the mean
+    /// cost of the known ones, and no subtree costs less than 1.
+    /// Chunks are returned largest first.
+    
+    chunks.clear();
+    
+    if ( subtrees.empty() ) return;
+    
+    std::vector<std::pair<Long64_t,std::string> > items;
+    std::vector<std::string> unknown;
+    Long64_t known(0);
+    
+    for ( std::set<std::string>::const_iterator it = subtrees.begin(); it != subtrees.end(); ++it )
     {
-      if (!gGrid)
+      std::map<std::string,Long64_t>::const_iterator c = costs.find(*it);
+      
+      if ( c != costs.end() )
       {
-        TGrid::Connect("alien://");
-        if (!gGrid)
-        {
-          cout << "Cannot get alien connection" << endl;
-          return;
-        }
+        items.push_back(std::make_pair(TMath::Max(c->second/TMath::Max(nworkers,1),1LL),*it));
+        known += items.back().first;
+      }
+      else
+      {
+        unknown.push_back(*it);
       }
-      
     }
-  
-  	TString file(url.GetFile());
-  
-//    file.ReplaceAll("/alice","/home/laphecet/data/alice");	
-//    file.ReplaceAll("/PWG3","/home/laphecet/PWG3");
-
-  	TString dir(gSystem->DirName(file));
-  	
-  	gSystem->mkdir(dir.Data(),kTRUE);
     
-    if ( gSystem->AccessPathName(file.Data())==kFALSE)
+    Long64_t unknownCost = items.empty() ? kScanChunkCost/8 : TMath::Max(known/(Long64_t)items.size(),1LL);
+    
+    for ( std::vector<std::string>::size_type i = 0; i < unknown.size(); ++i )
     {
-      cout << "Skipping copy of " << file.Data() << " as it already exists" << endl;
+      items.push_back(std::make_pair(unknownCost,unknown[i]));
     }
-    else
+    
+    Long64_t total = known + unknownCost*unknown.size();
+    
+    std::vector<ScanChunk>::size_type nchunks = (total + kScanChunkCost - 1)/kScanChunkCost;
+    
+    nchunks = std::min(std::max(nchunks,(std::vector<ScanChunk>::size_type)1),items.size());
+    
+    chunks.resize(nchunks);
+    
+    std::sort(items.rbegin(),items.rend());
+    
+    for ( std::vector<std::pair<Long64_t,std::string> >::size_type i = 0; i < items.size(); ++i )
     {
-      std::cout << "TFile::Cp(" << line << "," << file.Data() << ")" << std::endl;
-  	  TFile::Cp(line,file.Data());
-      if ( TString(line).Remove(TString::kTrailing,' ').EndsWith("zip") )
+      std::vector<ScanChunk>::iterator cheapest = chunks.end();
+      
+      for ( std::vector<ScanChunk>::iterator it = chunks.begin(); it != chunks.end(); ++it )
       {
-        gSystem->Exec(Form("unzip %s -d %s",file.Data(),gSystem->DirName(file.Data())));
-        gSystem->Exec(Form("rm %s",file.Data()));
+        if ( it->fDirs.size() >= kScanChunkMaxDirs ||
+            ( !it->fDirs.empty() && it->fLength + items[i].second.size() > kScanChunkMaxLength ) ) continue;
+        
+        if ( cheapest == chunks.end() || it->fCost < cheapest->fCost ) cheapest = it;
       }
-      if (strlen(url.GetAnchor())>0)
+      
+      if ( cheapest == chunks.end() )
       {
-        gSystem->Exec(Form("unzip %s %s -d %s",file.Data(),url.GetAnchor(),gSystem->DirName(file.Data())));
-        gSystem->Exec(Form("rm %s",file.Data()));
+        chunks.push_back(ScanChunk());
+        cheapest = chunks.end() - 1;
       }
-  	}
-  }
-}
-
-//__________________________________________________________________________________________________
-VAF* VAF::Create(const char* af)
-{
-  TString envFile(gSystem->ExpandPathName("$HOME/.aaf"));
-  
-  if ( gSystem->AccessPathName(envFile.Data()) )
-  {
-    std::cerr << "Cannot work without an environment file. Please make a $HOME/.aaf file !" << std::endl;
-    throw;
+      
+      cheapest->fCost += items[i].first;
+      cheapest->fLength += items[i].second.size();
+      cheapest->fDirs.push_back(items[i].second);
+    }
+    
+    std::sort(chunks.begin(),chunks.end(),LargerCost);
   }
   
-  TEnv env;
-  
-  env.ReadFile(envFile,kEnvAll);
-  
-  TString afMaster = env.GetValue(Form("%s.master",af),"unknown");
-  Bool_t afDynamic = env.GetValue(Form("%s.dynamic",af),kFALSE);
+  // number of ranges of contiguous entries read when sampling the entries of a tree
+  const Long64_t kSampleRanges(10);
   
-  VAF* vaf(0x0);
+  typedef std::vector<std::pair<Long64_t,Long64_t> > EntryRanges;
   
-  if ( afMaster != "unknown" )
+  EntryRanges SampleEntryRanges(Long64_t nentries, Double_t fraction, UInt_t seed)
   {
-    std::string className("AFStatic");
+    /// Pick [first,last[ ranges of entries covering about fraction of the nentries.
+    /// Ranges are contiguous (to read each basket only once) and each one is
+    /// drawn in its own slice of the tree, so they spread over the whole file.
     
-    if ( afDynamic )
+    EntryRanges ranges;
+    
+    if ( fraction >= 1.0 || nentries <= 0 )
     {
-      className = "AFDynamic";
+      ranges.push_back(std::make_pair(0LL,nentries));
+      return ranges;
     }
     
-    TClass* c = TClass::GetClass(className.c_str());
+    Long64_t nranges = TMath::Min(kSampleRanges,nentries);
+    Long64_t length = TMath::Max(1LL,static_cast<Long64_t>(TMath::Ceil(nentries*fraction/nranges)));
+    Long64_t slice = nentries/nranges;
     
-    if (!c)
+    TRandom3 rnd(seed);
+    
+    for ( Long64_t r = 0; r < nranges; ++r )
     {
-      std::cerr << Form("Cannot get class %s",className.c_str()) << std::endl;
-      return 0x0;
+      Long64_t first = r*slice;
+      Long64_t span = ( r == nranges-1 ? nentries : first + slice ) - first;
+      Long64_t len = TMath::Min(length,span);
+      Long64_t start = first + rnd.Integer(span-len+1);
+      
+      ranges.push_back(std::make_pair(start,start+len));
     }
     
-    TMethodCall call;
-    
-    call.InitWithPrototype(c,className.c_str(),"char*");
+    return ranges;
+  }
+  
+  UInt_t FileSeed(UInt_t seed, const char* file)
+  {
+    /// Per-file seed, so that files do not all get the same entries sampled
+    /// (from the full url, as files of a dataset usually share the same name)
+    return seed + TString(file).Hash();
+  }
+  
+  std::vector<std::size_t> SampleFiles(std::size_t n, Double_t fraction, UInt_t seed)
+  {
+    /// Indices (sorted) of the files to be checked among n, all of them unless fraction < 1
     
-    Long_t returnLong(0x0);
+    std::vector<std::size_t> sample;
     
-    Long_t params[] = { (Long_t)(&(afMaster.Data()[0])) };
-    call.SetParamPtrs((void*)(params));
-    call.Execute((void*)(0x0),returnLong);
+    for ( std::size_t i = 0; i < n; ++i )
+    {
+      sample.push_back(i);
+    }
     
-    if (!returnLong)
+    if ( fraction < 1.0 && !sample.empty() )
     {
-      std::cout << "Cannot create an AF of class " << className << std::endl;
-      return 0x0;
+      TRandom3 rnd(seed);
+      
+      for ( std::size_t i = sample.size()-1; i > 0; --i )
+      {
+        std::swap(sample[i],sample[rnd.Integer(i+1)]);
+      }
+      
+      std::size_t nsample = TMath::Max(1,TMath::CeilNint(sample.size()*fraction));
+      
+      sample.resize(TMath::Min(nsample,sample.size()));
+      std::sort(sample.begin(),sample.end());
     }
     
-    vaf = reinterpret_cast<VAF*> (returnLong);
+    return sample;
   }
-  else
+  
+  std::string RunOfFile(const std::string& path)
   {
-    std::cerr << "Could not get master information for AF named " << af << std::endl;
+    /// Return the first path component that looks like a run number
+    /// (6 digits or more, to leave out years), or "unknown"
+    
+    std::string::size_type start(0);
+    
+    while ( start < path.size() )
+    {
+      std::string::size_type end = path.find('/',start);
+      if ( end == std::string::npos ) end = path.size();
+      
+      std::string component = path.substr(start,end-start);
+      
+      if ( component.size() >= 6 && component.find_first_not_of("0123456789") == std::string::npos )
+      {
+        return component;
+      }
+      start = end + 1;
+    }
+    return "unknown";
   }
   
-  if ( vaf )
+  void WilsonInterval(Int_t k, Int_t n, Double_t& low, Double_t& high)
   {
-    TString homeDir = env.GetValue(Form("%s.home",af),"/home/PROOF-AAF");
-    TString logDir = env.GetValue(Form("%s.log",af),"/home/PROOF-AAF");
+    /// 95% confidence interval of a proportion k/n (Wilson score interval,
+    /// which stays sensible for k=0 or small n)
     
-    vaf->SetHomeAndLogDir(homeDir.Data(),logDir.Data());
+    low = 0.0;
+    high = 1.0;
     
-    TString fileType = env.GetValue(Form("%s.filetype",af),"f");
+    if ( n <= 0 ) return;
     
-    vaf->SetFileTypeToLookFor(fileType[0]);
+    const Double_t z(1.96);
+    Double_t p = k*1.0/n;
+    Double_t d = 1.0 + z*z/n;
+    Double_t c = p + z*z/(2.0*n);
+    Double_t r = z*TMath::Sqrt(p*(1.0-p)/n + z*z/(4.0*n*n));
+    
+    low = TMath::Max(0.0,(c-r)/d);
+    high = TMath::Min(1.0,(c+r)/d);
   }
   
-  return vaf;
-}
-
-//______________________________________________________________________________
-void VAF::CreateDataSets(const char* runlist,
-                         const char* dataType,
-                         const char* esdpass,
-                         int aodPassNumber,
-                         const char* basename,
-                         Int_t fileLimit)
-{
-  std::vector<int> runs;
-  
-  ReadIntegers(runlist,runs);
-  
-  CreateDataSets(runs,dataType,esdpass,aodPassNumber,basename,fileLimit);
-}
-
-//______________________________________________________________________________
-void VAF::CreateDataSets(Int_t runNumber,
-                         const char* dataType,
-                         const char* esdpass,
-                         int aodPassNumber,
-                         const char* basename,
-                         Int_t fileLimit)
-{
-  std::vector<int> runs;
-  
-  runs.push_back(runNumber);
-  
-  CreateDataSets(runs,dataType,esdpass,aodPassNumber,basename,fileLimit);
-}
-
-//______________________________________________________________________________
-TString VAF::DecodeDataType(const char* dataType, TString& what, TString& treeName, TString& anchor, Int_t aodPassNumber) const
-{
-  // dataType is case insensitive and will be converted into []
-  //
-  // *stat* -> [EventStat_temp.root]
-  // *zip* -> [root_archive.zip] or [AOD_archive.zip]
-  // *esd* -> [AliESDs.root]
-  // *esd_outer* -> [AliESDs_Outer.root]
-  // *esd_barrel* -> [AliESDs_Barrel.root]
-  // *aod* -> [AliAOD.root]
-  // *aodmuon* -> [AliAOD.Muons.root]
-  // *aoddimuon* -> [AliAOD.Dimuons.root]
-  // *esd.tag* -> [ESD.tag]
-  // *raw* -> [raw data file]
-  
-  TString sdatatype(dataType);
-  sdatatype.ToUpper();
-  TString defaultWhat("unknown");
-  
-  what = defaultWhat;
-  
-  treeName = "";
+  // number of temporary files the FindDuplicates input is spread over
+  const Int_t kDuplicatePartitions(64);
   
-  anchor="";
+  struct FileReplicas
+  {
+    FileReplicas() : fSize(0), fServers() {}
+    
+    Long64_t fSize; // file size
+    std::vector<UShort_t> fServers; // (interned) servers having a copy of the file
+  };
   
-  if ( sdatatype.Contains("ESD.TAG") )
+  Double_t ServerLoad(const std::vector<Double_t>& used, const std::vector<Double_t>& capacity, std::size_t id)
   {
-    what = "*ESD.tag.root";
+    /// Fraction used if the capacity is known, used amount otherwise
+    return capacity[id] > 0 ? used[id]/capacity[id] : used[id];
   }
-  else if ( sdatatype.Contains("ESD_OUTER") )
+  
+  void SplitLine(const std::string& line, std::vector<std::string>& tokens)
   {
-    what = "AliESDs_Outer.root";
-    treeName="/esdTree";
+    /// Split line on blanks (without the allocations of TString::Tokenize)
+    
+    tokens.clear();
+    
+    std::string::size_type start = line.find_first_not_of(" \t");
+    
+    while ( start != std::string::npos )
+    {
+      std::string::size_type end = line.find_first_of(" \t",start);
+      
+      tokens.push_back(line.substr(start,end == std::string::npos ? std::string::npos : end-start));
+      
+      start = line.find_first_not_of(" \t",end);
+    }
   }
-  else if ( sdatatype.Contains("ESD_BARREL") )
+  
+  std::string DataSetGroup(const TString& sname)
   {
-    what = "AliESDs_Barrel.root";
-    treeName="/esdTree";
+    /// The group of a dataset is its name without its run number
+    
+    TString test(sname.Data());
+    
+    Int_t ix = test.Index("_000");
+    
+    TString id(sname.Data());
+    
+    if ( ix >= 0 )
+    {
+      TString runNumber = test(ix,10);
+      test.ReplaceAll(runNumber,"");
+      test.ReplaceAll(" ","");
+      id = test;
+    }
+    
+    return id.Data();
   }
-  else if ( sdatatype.Contains("ESD") )
+  
+  struct JournalEntry
   {
-    what = "AliESDs.root";
-    treeName="/esdTree";
+    JournalEntry() : fTime(0), fSize(0), fMtime(0), fLevel(0), fEntryFraction(0.0), fResult(0), fDuration(0.0) {}
+    
+    Long_t fTime; // when the check was done
+    Long64_t fSize; // size of the file when checked
+    Long_t fMtime; // modification time of the file when checked
+    Int_t fLevel; // VAF::ECheckLevel used
+    Double_t fEntryFraction; // fraction of the entries checked
+    Int_t fResult; // TestROOTFile result
+    Double_t fDuration; // time (s) the check took
+  };
+  
+  typedef std::map<std::string,JournalEntry> Journal;
+  
+  void ReadJournal(const char* filename, Journal& journal)
+  {
+    /// Read a check journal : one line per file checked, the latest line
+    /// of a given file superseding the previous ones.
+    /// Format is : time size mtime level entryfraction result duration url
+    
+    std::ifstream in(filename);
+    std::string line;
+    
+    while ( std::getline(in,line) )
+    {
+      std::istringstream sin(line);
+      JournalEntry e;
+      std::string url;
+      
+      if ( sin >> e.fTime >> e.fSize >> e.fMtime >> e.fLevel >> e.fEntryFraction >> e.fResult >> e.fDuration >> url )
+      {
+        journal[url] = e;
+      }
+    }
   }
-  else if ( sdatatype.Contains("AODMU") )
+  
+  Bool_t IsStillValid(const JournalEntry& e, const FileStat_t& st, Int_t level, Double_t entryFraction)
   {
-    what = "AliAOD.Muons.root";
-    treeName="/aodTree";
+    /// Whether a journaled check can be reused for a file in its current state.
+    /// A bad file stays bad, while a good one must have been checked at least as
+    /// thoroughly as now requested (kFullCheck being the lowest, i.e. most thorough, level)
+    
+    if ( e.fSize != st.fSize || e.fMtime != st.fMtime ) return kFALSE;
+    
+    return ( e.fResult < 0 || ( e.fLevel <= level && e.fEntryFraction >= entryFraction ) );
   }
-  else if ( sdatatype.Contains("AODDIMU") )
+  
+  TString FormatDuration(Double_t seconds)
   {
-    what = "AliAOD.Dimuons.root";
-    treeName="/aodTree";
+    Int_t s = TMath::Nint(seconds);
+    return Form("%dh%02dm%02ds",s/3600,(s%3600)/60,s%60);
   }
-  else if ( sdatatype.Contains("AODHF") )
+  
+  Bool_t MergeFiles(const std::vector<std::string>& inputs, const char* output, Bool_t local)
   {
-    what = "AliAOD.VertexingHF.root";
-    treeName = "/aodTree";
+    /// Merge the inputs into output
+    /// (with its own TFileMerger, so it can be used from several threads).
+    /// As TFileMerger itself would, inputs that cannot be added are skipped
+    /// (and reported) : the merging only fails if none could be added.
+    
+    TFileMerger fm(local,kFALSE);
+    std::vector<std::string>::size_type nadded(0);
+    
+    for ( std::vector<std::string>::size_type i = 0; i < inputs.size(); ++i )
+    {
+      if (fm.AddFile(inputs[i].c_str(),kFALSE))
+      {
+        ++nadded;
+      }
+      else
+      {
+        std::cout << Form("Skipping %s (cannot be added to the merging of %s)\n",inputs[i].c_str(),output) << std::flush;
+      }
+    }
+    
+    if (!nadded) return kFALSE;
+    
+    return fm.OutputFile(output) && fm.Merge();
   }
-  else if ( sdatatype.Contains("AODJE") )
+  
+  // max length of the shell commands sent to the workers (a single argument
+  // of sh -c cannot exceed 128 kB)
+  const std::string::size_type kMaxShellCommand(100000);
+  
+  std::string ShellQuote(const std::string& arg)
   {
-    what = "AliAOD.Jets.root";
-    treeName = "/aodTree";
+    /// arg, single quoted for the shell
+    
+    std::string rv("'");
+    
+    for ( std::string::size_type i = 0; i < arg.size(); ++i )
+    {
+      if ( arg[i] == '\'' ) rv += "'\\''";
+      else rv += arg[i];
+    }
+    
+    return rv + "'";
   }
-  else if ( sdatatype.Contains("AOD") )
+  
+  std::string ShortHost(const std::string& host)
   {
-    what = "AliAOD.root";
-    treeName = "/aodTree";
+    /// host without its domain (what hostname -s gives on the host itself)
+    
+    return host.substr(0,host.find('.'));
   }
-  else if ( sdatatype.Contains("STAT") )
+  
+  Bool_t SameHost(const std::string& a, const std::string& b)
   {
-    what = "EventStat_temp.root";
+    /// Whether a and b name the same host, one possibly having the domain the other lacks
+    
+    return ShortHost(a) == ShortHost(b);
   }
-  else if ( sdatatype.Contains("RAW") )
+  
+  struct MergeJob
   {
-    what = "*.root";
+    MergeJob() : fName(), fOutput(), fInputs(), fHosts(), fSize(0) {}
+    
+    std::string fName; // dataset name
+    std::string fOutput; // merged file
+    std::vector<std::string> fInputs; // files to be merged
+    std::set<std::string> fHosts; // servers the inputs are read from
+    Long64_t fSize; // total size of the inputs
+  };
+  
+  bool LargerJob(const MergeJob& a, const MergeJob& b)
+  {
+    return a.fSize > b.fSize;
   }
-  if ( sdatatype.Contains("ZIP") )
+  
+  struct BranchSize
   {
-    if ( what != defaultWhat )
+    BranchSize() : fZipBytes(0), fTotBytes(0), fEntries(0), fNFiles(0) {}
+    
+    Long64_t fZipBytes; // compressed size
+    Long64_t fTotBytes; // uncompressed size
+    Long64_t fEntries; // number of entries
+    Int_t fNFiles; // number of files where the branch was found
+  };
+  
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,20,0)
+  typedef ROOT::RCompressionSetting::EAlgorithm::EValues ZipAlgorithm;
+#elif ROOT_VERSION_CODE >= ROOT_VERSION(6,12,0)
+  typedef ROOT::ECompressionAlgorithm ZipAlgorithm;
+#else
+  typedef int ZipAlgorithm;
+#endif
+  
+  // compression settings (100*algorithm+level) tried by AdviseCompression (0 terminated)
+  const Int_t kCompressionSettings[] = { 101, 104, 106, 109, 201, 205, 209,
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,12,0)
+    401, 404, 409,
+#endif
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,20,0)
+    501, 505, 509,
+#endif
+    0 };
+  
+  // largest buffer compressed in one go by ROOT (same as in TBasket)
+  const Int_t kMaxZipBuffer(0xffffff);
+  
+  // size of the header ROOT puts in front of each compressed chunk
+  const Int_t kZipHeader(9);
+  
+  const char* CompressionAlgorithmName(Int_t algorithm)
+  {
+    switch (algorithm)
     {
-      anchor = what;
-      anchor.ReplaceAll("ZIP","");
+      case 1: return "zlib";
+      case 2: return "lzma";
+      case 4: return "lz4";
+      case 5: return "zstd";
+      default: return "?";
     }
-    //    else
-    //    {
-    //      cout << "type=" << dataType << " is not enough to know what to look for..." << endl;
-    //      return 0x0;
-    //    }
-    if ( sdatatype.Contains("AOD") )
+  }
+  
+  struct CompressionSample
+  {
+    CompressionSample() : fRawBytes(0), fZipBytes(0), fTime(0.0) {}
+    
+    Long64_t fRawBytes; // uncompressed bytes sampled
+    Long64_t fZipBytes; // their size once compressed
+    Double_t fTime; // time (s) to decompress them
+  };
+  
+  Int_t Compress(Int_t setting, char* src, Int_t srcsize, std::vector<char>& tgt, std::vector<Int_t>& chunks)
+  {
+    /// Compress src the way ROOT does for baskets (by chunks of at most kMaxZipBuffer bytes,
+    /// stored as is if they do not compress). Chunks get the compressed size of each chunk
+    /// (negative if stored as is). Return the total compressed size.
+    
+    tgt.resize(srcsize + kZipHeader*(srcsize/kMaxZipBuffer+1));
+    chunks.clear();
+    
+    Int_t total(0);
+    
+    for ( Int_t offset = 0; offset < srcsize; offset += kMaxZipBuffer )
     {
-      //      if ( aodPassNumber < 0 )
-      //      {
-      //        what = "aod_archive.zip";
-      //      }
-      //      else
-      if ( aodPassNumber == 0 )
+      Int_t bufsize = TMath::Min(kMaxZipBuffer,srcsize-offset);
+      Int_t tgtsize = bufsize;
+      Int_t nout(0);
+      
+      R__zipMultipleAlgorithm(setting%100,&bufsize,src+offset,&tgtsize,&tgt[total],&nout,
+                              static_cast<ZipAlgorithm>(setting/100));
+      
+      if ( nout == 0 || nout >= bufsize )
       {
-        what = "aod_archive.zip";
-        //        what = "AOD_archive.zip";
+        memcpy(&tgt[total],src+offset,bufsize);
+        chunks.push_back(-bufsize);
+        total += bufsize;
       }
       else
       {
-        what = "root_archive.zip";
+        chunks.push_back(nout);
+        total += nout;
       }
     }
-    else
+    
+    return total;
+  }
+  
+  void Decompress(std::vector<char>& src, const std::vector<Int_t>& chunks, Int_t rawsize, std::vector<char>& tgt)
+  {
+    /// Reverse of Compress
+    
+    tgt.resize(rawsize);
+    
+    Int_t in(0);
+    Int_t out(0);
+    
+    for ( std::vector<Int_t>::size_type i = 0; i < chunks.size(); ++i )
     {
-      what = "root_archive.zip";
+      if ( chunks[i] < 0 )
+      {
+        memcpy(&tgt[out],&src[in],-chunks[i]);
+        in -= chunks[i];
+        out -= chunks[i];
+        continue;
+      }
+      
+      Int_t nin = chunks[i];
+      Int_t nbuf = rawsize - out;
+      Int_t nout(0);
+      
+      R__unzip(&nin,reinterpret_cast<unsigned char*>(&src[in]),&nbuf,reinterpret_cast<unsigned char*>(&tgt[out]),&nout);
+      
+      in += chunks[i];
+      out += nout;
     }
   }
   
-  return sdatatype;
-}
-
-//______________________________________________________________________________
-void VAF::GetDataSetList(TList& list, const char* path)
-{
-  list.SetOwner(kTRUE);
-  list.Clear();
-  
-  if ( Connect() )
+  void GetAllBranches(TObjArray* branches, std::vector<TBranch*>& all)
   {
-    TMap* datasets = gProof->GetDataSets(path, ":lite:");
+    /// Flatten the branch hierarchy
     
-    if (!datasets)
+    TIter next(branches);
+    TBranch* b;
+    
+    while ( ( b = static_cast<TBranch*>(next()) ) )
     {
-      return;
+      all.push_back(b);
+      GetAllBranches(b->GetListOfBranches(),all);
     }
+  }
+  
+  Bool_t CheckBaskets(TBranch& branch, const EntryRanges& ranges)
+  {
+    /// Read and decompress all the baskets of one branch holding entries
+    /// within the given ranges, and check that what
+    /// is read agrees with what the branch metadata says about each basket
+    /// (compressed size and number of entries).
+    /// Decompression errors (including those of the checksums of the compression
+    /// algorithms that have one) make GetBasket fail.
     
-    datasets->SetOwnerKeyValue();  // important to avoid leaks!
-    TIter dsIterator(datasets);
-    TObjString* dsName;
+    Int_t* basketBytes = branch.GetBasketBytes();
+    Long64_t* basketEntry = branch.GetBasketEntry();
+    Bool_t ok(kTRUE);
     
-    while ((dsName = static_cast<TObjString *>(dsIterator.Next())))
+    for ( Int_t i = 0; i < branch.GetWriteBasket() && ok; ++i )
     {
-      list.Add(new TObjString(*dsName));
+      Bool_t selected(kFALSE);
+      
+      for ( EntryRanges::size_type r = 0; r < ranges.size() && !selected; ++r )
+      {
+        selected = ( basketEntry[i] < ranges[r].second && basketEntry[i+1] > ranges[r].first );
+      }
+      
+      if (!selected) continue;
+      
+      TBasket* basket = branch.GetBasket(i);
+      
+      if ( !basket )
+      {
+        std::cout << "Cannot read basket " << i << " of branch " << branch.GetName() << std::endl;
+        ok = kFALSE;
+      }
+      else if ( basket->GetNbytes() != basketBytes[i] ||
+               basket->GetNevBuf() != basketEntry[i+1] - basketEntry[i] )
+      {
+        std::cout << "Basket " << i << " of branch " << branch.GetName() << " has "
+        << basket->GetNbytes() << " bytes and " << basket->GetNevBuf() << " entries instead of "
+        << basketBytes[i] << " and " << basketEntry[i+1] - basketEntry[i] << std::endl;
+        ok = kFALSE;
+      }
+      
+      branch.DropBaskets("all");
     }
+    
+    return ok;
   }
-}
-
-//______________________________________________________________________________
-void VAF::GetDataSetsSize(const char* dsList, Bool_t showDetails)
-{
-  // compute the size of a list of datasets
-  
-  ifstream in(gSystem->ExpandPathName(dsList));
-	char line[1024];
   
-  Int_t nFiles(0);
-  Int_t nCorruptedFiles(0);
-  Long64_t size(0);
+  // what the server index knows about one dataset file
+  struct IndexedDataSet
+  {
+    IndexedDataSet() : fModTime(0), fSize(0), fServers() {}
+    
+    Long_t fModTime; // modification time of the dataset file when indexed
+    Long64_t fSize; // size of the dataset file when indexed
+    std::set<std::string> fServers; // servers holding some of its files
+  };
   
-  Int_t totalFiles(0);
-  Int_t totalCorruptedFiles(0);
-  Long64_t totalSize(0);
+  // one file of a server index
+  struct IndexedFile
+  {
+    std::string fDataSet;
+    Long64_t fSize;
+    std::string fUrl;
+  };
   
-  Int_t n(0);
+  const char* kServerIndexManifest = "manifest.txt";
   
-	while ( in.getline(line,1024,'\n') )
-	{
-    GetOneDataSetSize(line,nFiles,nCorruptedFiles,size,showDetails);
-    ++n;
-    totalFiles += nFiles;
-    totalCorruptedFiles += nCorruptedFiles;
-    totalSize += size;
+  void ReadServerIndexManifest(const TString& indexDir, std::map<std::string,IndexedDataSet>& manifest)
+  {
+    /// Manifest lines are : dataset mtime size server1,server2,...
+    
+    std::ifstream in(Form("%s/%s",indexDir.Data(),kServerIndexManifest));
+    std::string line;
+    
+    while ( std::getline(in,line) )
+    {
+      std::istringstream sline(line);
+      std::string dsname;
+      std::string servers;
+      IndexedDataSet ds;
+      
+      if (!(sline >> dsname >> ds.fModTime >> ds.fSize)) continue;
+      
+      sline >> servers;
+      
+      TObjArray* a = TString(servers.c_str()).Tokenize(",");
+      TIter next(a);
+      TObjString* str;
+      
+      while ( ( str = static_cast<TObjString*>(next()) ) )
+      {
+        ds.fServers.insert(str->String().Data());
+      }
+      
+      delete a;
+      
+      manifest[dsname] = ds;
+    }
   }
   
-  cout << Form("ndatasets=%3d nfiles = %5d | ncorrupted = %5d | size = %7.2f GB",n,totalFiles,totalCorruptedFiles,totalSize/byte2GB) << endl;
+  void ReadServerIndex(const TString& indexDir, const std::string& server, std::vector<IndexedFile>& files)
+  {
+    /// Server index lines are : dataset size url
+    
+    std::ifstream in(Form("%s/%s.idx",indexDir.Data(),server.c_str()));
+    IndexedFile f;
+    
+    while ( in >> f.fDataSet >> f.fSize >> f.fUrl )
+    {
+      files.push_back(f);
+    }
+  }
 }
+using namespace std;
 
 //______________________________________________________________________________
-void VAF::EmergencyRemoval()
+VAF::VAF(const char* master) : fConnect(""), fDryRun(kTRUE), fMergedOnly(kTRUE),
+fSimpleRunNumbers(kFALSE), fFilterName(""), fMaster(master),
+fHomeDir(""),fLogDir(""), fFileTypeToLookFor('f'), fAliPhysics(""), fForceUpdate(kFALSE),
+fCacheDir(""), fCacheTTL(0), fParallelism(1), fCheckLevel(kFullCheck),
+fSampleFileFraction(1.0), fSampleEntryFraction(1.0), fSampleSeed(4357), fSampleEscalation(2),
+fJournalDir(""), fMergeFanIn(0), fMaxReadsPerServer(2), fMaxWrites(2), fMergeOnServers(kFALSE)
 {
-  /// Emergency removal of files being staged...
+  if ( TString(master) != "unknown" )
+  {
+    fConnect = master;
+    fConnect += "/?N";
+  }
   
-  if (!Connect("workers=1x")) return;
+//  std::cout << "Connect string to be used = " << fConnect.Data() << std::endl;
+}
 
-  TString s = GetStringFromExec(".! find /data/alice/data/2011/LHC11h/000170387/raw -name *.root");
+//______________________________________________________________________________
+TString VAF::JournalFileName(const char* dsname) const
+{
+  /// Name of the file where the checks of the given dataset are journaled
   
-  TObjArray* a = s.Tokenize("\n");
-  TObjString* os;
-  TIter next(a);
+  TMD5 md5;
   
-  TObjArray cmds;
-  cmds.SetOwner(kTRUE);
+  md5.Update((const UChar_t*)dsname,(UInt_t)strlen(dsname));
+  md5.Final();
   
-  while ( ( os = static_cast<TObjString*>(next())) )
+  return Form("%s/%s.txt",fJournalDir.Data(),md5.AsString());
+}
+
+//______________________________________________________________________________
+void VAF::ShowCheckProgress(const char* dsname)
+{
+  /// Show how far the check of one dataset went, from its journal,
+  /// and how long it would take to complete it.
+  /// When sampling (see SetSampling) only the files of the sample are counted,
+  /// which leaves out those a later escalation to a full check would add.
+  
+  if ( fJournalDir.Length() == 0 )
   {
-    TString line = os->String();
-    
-    if ( !line.Contains("LHC11h") ) continue;
+    std::cout << "No journal directory defined" << std::endl;
+    return;
+  }
+  
+  std::unique_ptr<TFileCollection> fc(GetDataSet(dsname));
+  
+  if (!fc)
+  {
+    std::cout << "cannot get dataset " << dsname << std::endl;
+    return;
+  }
+  
+  Journal journal;
+  
+  ReadJournal(JournalFileName(dsname).Data(),journal);
+  
+  // same files, in the same order, as CheckOneDataSet picks its sample from
+  std::vector<TFileInfo*> candidates;
+  TIter next(fc->GetList());
+  TFileInfo* fi;
+  
+  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  {
+    if (!fi->TestBit(TFileInfo::kStaged) || fi->TestBit(TFileInfo::kCorrupted)) continue;
     
-    TString cmd;
+    candidates.push_back(fi);
+  }
+  
+  std::vector<std::size_t> sample = SampleFiles(candidates.size(),fSampleFileFraction,fSampleSeed);
+  Long64_t nfiles(0), ndone(0), nbad(0);
+  Long64_t totalSize(0), doneSize(0);
+  Double_t cumulated(0.0);
+  
+  for ( std::vector<std::size_t>::size_type i = 0; i < sample.size(); ++i )
+  {
+    fi = candidates[sample[i]];
     
-    line.ReplaceAll("/data/alice","/alice");
+    ++nfiles;
+    totalSize += fi->GetSize();
     
-    cmd.Form("xrd nansafmaster2 rm %s",line.Data());
+    Journal::const_iterator it = journal.find(fi->GetFirstUrl()->GetUrl());
     
-    cmds.Add(new TObjString(cmd));
+    if ( it != journal.end() )
+    {
+      ++ndone;
+      doneSize += fi->GetSize();
+      cumulated += it->second.fDuration;
+      if ( it->second.fResult < 0 ) ++nbad;
+    }
   }
   
-  delete a;
-
-  CloseConnection();
-  
-  Connect("masteronly");
-  
-  TIter nextCmd(&cmds);
+  std::cout << Form("%s : %lld/%lld files (%5.1f %%) %7.2f/%7.2f GB checked, %lld bad",
+                    dsname,ndone,nfiles,nfiles > 0 ? ndone*100.0/nfiles : 0.0,
+                    doneSize/byte2GB,totalSize/byte2GB,nbad) << std::endl;
   
-  while ( ( os = static_cast<TObjString*>(nextCmd())) )
+  if ( IsSampling() )
   {
-    std::cout << os->String().Data() << std::endl;
-    gProof->Exec(Form(".! %s",os->String().Data()));
+    std::cout << Form("(sample of %lld files out of %lu, %g of the entries : escalations to a full check are not included)",
+                      nfiles,candidates.size(),fSampleEntryFraction) << std::endl;
   }
   
-  CloseConnection();
-
+  if ( doneSize > 0 && ndone < nfiles )
+  {
+    Double_t eta = ( totalSize - doneSize ) * cumulated / doneSize / TMath::Max(Parallelism(),1);
+    
+    std::cout << "ETA " << FormatDuration(eta).Data() << " (with " << TMath::Max(Parallelism(),1) << " threads)" << std::endl;
+  }
 }
 
 //______________________________________________________________________________
-void VAF::CloseConnection()
+TString VAF::CacheFileName(const char* dsname) const
 {
-  if ( gProof )
-  {
-    gProof->Close("s");
-    delete gProof;
-    gProof = 0x0;
-  }
+  /// Name of the file caching the given dataset (its name can be a query
+  /// containing all sorts of characters, hence the hash)
+  
+  TMD5 md5;
+  
+  md5.Update((const UChar_t*)dsname,(UInt_t)strlen(dsname));
+  md5.Final();
+  
+  return Form("%s/%s.root",fCacheDir.Data(),md5.AsString());
 }
 
 //______________________________________________________________________________
-void VAF::GenerateReports()
+Int_t VAF::CheckOneDataSet(const char* dsname)
 {
-  // Retrieve the complete list of files on this AF for each worker,
-  // and delegates the actual report generation to AFWebMaker class
+  std::ofstream out("check-one-dataset.sh");
   
-  if (!Connect("workers=1x")) return;
+  Int_t rv = CheckOneDataSet(dsname,out);
   
-  TUrl u(gProof->GetDataPoolUrl());
+  out.close();
+
+  return rv;
+}
+
+//______________________________________________________________________________
+Int_t VAF::CheckOneDataSet(const char* dsname, std::ofstream& out)
+{
+  /// Check one data set
+  /// The check itself is handled by the TestROOTFile method (at the CheckLevel() level),
+  /// for up to Parallelism() files at the same time.
+  /// When sampling (see SetSampling) only a fraction of the files (and of their entries)
+  /// is checked, an estimate of the corruption rate of the whole dataset is given,
+  /// and the runs or servers where sampled failures cluster get a full check.
+  /// Each file checked is appended to the journal of the dataset (see JournalFileName), so
+  /// that a restarted check skips the files already done that have not changed since.
+  /// Return the number of bad files, and write the commands to remove them
+  /// to out, as soon as they are found
   
-  TList* list = gProof->GetListOfSlaveInfos();
-  Int_t nworkers = list->GetSize();
+  std::cout << "Testing dataset " << dsname << " ... " << std::endl;
   
-  std::set<std::string> topdirs;
+  std::unique_ptr<TFileCollection> fc(GetDataSet(dsname));
   
-  // to overcome possible limitation in the size of the log file which is used to
-  // transmit back the macrolog, we split the request per year where possible,
-  // and per "top" directory otherwise
+  if (!fc)
+  {
+    std::cout << "cannot get dataset " << dsname << std::endl;
+    return -2;
+  }
+  else
+  {
+    std::cout << "Scanning " << fc->GetList()->GetLast() << " files" << std::endl;
+  }
+  TIter next(fc->GetList());
+  TFileInfo* fi;
+  TString treeName(fc->GetDefaultTreeName());
+  treeName.ReplaceAll("/","");
   
-  // the /alice/sim directory is not strictly ordered by year...
-  // so have to get a full list of the first level below it...
+  std::vector<std::string> urls;
+  std::vector<std::string> hosts;
+  std::vector<std::string> files;
+  std::vector<Long64_t> sizes;
   
-  topdirs.insert(Form("%s/alice/cern.ch",u.GetFile()));
+  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  {
+    if (!fi->TestBit(TFileInfo::kStaged) || fi->TestBit(TFileInfo::kCorrupted)) continue;
+    
+    TUrl url(*(fi->GetFirstUrl()));
+    
+    urls.push_back(url.GetUrl());
+    hosts.push_back(url.GetHost());
+    files.push_back(url.GetFile());
+    sizes.push_back(fi->GetSize());
+  }
   
-  TString s;
+  std::vector<int> results(urls.size(),0);
+  std::vector<Double_t> durations(urls.size(),0.0);
+  std::vector<bool> checked(urls.size(),false);
   
-  s += GetStringFromExec(Form(".! find %s/alice/sim -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
+  Int_t nbad(0);
+  std::vector<std::string>::size_type ndone(0);
+  std::mutex mutex;
+  Bool_t verbose = ( Parallelism() <= 1 );
   
-  s += GetStringFromExec(Form(".! find %s/alice/data/2010 -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
-  s += GetStringFromExec(Form(".! find %s/alice/data/2011 -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
-  s += GetStringFromExec(Form(".! find %s/alice/data/2012 -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
-  s += GetStringFromExec(Form(".! find %s/alice/data/2013 -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
-  s += GetStringFromExec(Form(".! find %s/alice/data/2014 -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   
-  //  s += GetStringFromExec(Form(".! find %s/alice/data/2015 -type d -mindepth 1 -maxdepth 1 ",u.GetFile()));
+  // files already checked (by a previous, possibly interrupted, check) and unchanged since then are skipped
+  Journal journal;
+  std::ofstream journalOut;
+  std::vector<std::string>::size_type nskipped(0);
+  Long64_t bytesToCheck(0);
+  Long64_t bytesChecked(0);
   
-  TObjArray* a = s.Tokenize("\n");
-  TObjString* os;
-  TIter next(a);
+  if ( fJournalDir.Length() > 0 )
+  {
+    gSystem->mkdir(fJournalDir.Data(),kTRUE);
+    
+    TString journalFile = JournalFileName(dsname);
+    
+    ReadJournal(journalFile.Data(),journal);
+    
+    journalOut.open(journalFile.Data(),std::ios::app);
+    
+    std::cout << "Journal " << journalFile.Data() << " has " << journal.size() << " files" << std::endl;
+  }
   
-  while ( ( os = static_cast<TObjString*>(next())) )
+  for ( std::vector<Long64_t>::size_type i = 0; i < sizes.size(); ++i )
   {
-    topdirs.insert(os->String().Data());
+    bytesToCheck += sizes[i];
   }
   
-  delete a;
+  auto checkFiles = [&](const std::vector<std::size_t>& indices, Double_t entryFraction)
+  {
+    AFParallel::ForEach(indices.size(),Parallelism(),[&](std::size_t j)
+    {
+      std::size_t i = indices[j];
+      
+      FileStat_t st;
+      Bool_t hasStat = ( gSystem->GetPathInfo(urls[i].c_str(),st) == 0 );
+      
+      Journal::const_iterator it = journal.find(urls[i]);
+      
+      if ( hasStat && it != journal.end() && IsStillValid(it->second,st,CheckLevel(),entryFraction) )
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        
+        results[i] = it->second.fResult;
+        durations[i] = 0.0;
+        checked[i] = true;
+        ++ndone;
+        ++nskipped;
+        bytesToCheck -= sizes[i];
+        
+        if ( results[i] < 0 )
+        {
+          out << Form("echo \"xrd %s rm %s\"",hosts[i].c_str(),files[i].c_str()) << std::endl;
+          out << "xrd " << hosts[i] << " rm " << files[i] << std::endl;
+          ++nbad;
+        }
+        return;
+      }
+      
+      std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      
+      int rv = TestROOTFile(urls[i].c_str(),treeName.Data(),verbose,CheckLevel(),entryFraction,fSampleSeed);
+      
+      std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+      
+      std::lock_guard<std::mutex> lock(mutex);
+      
+      results[i] = rv;
+      durations[i] = dt.count();
+      checked[i] = true;
+      ++ndone;
+      bytesChecked += sizes[i];
+      
+      if ( journalOut.is_open() && hasStat )
+      {
+        journalOut << time(0) << " " << st.fSize << " " << st.fMtime << " " << CheckLevel() << " "
+        << entryFraction << " " << rv << " " << dt.count() << " " << urls[i] << std::endl;
+      }
+      
+      if (!verbose)
+      {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        Double_t eta = ( bytesChecked > 0 ) ? ( bytesToCheck - bytesChecked ) * elapsed.count() / bytesChecked : 0.0;
+        
+        std::cout << Form("[%5lu/%5lu] %10d entries %7.1f s ETA %s %s",ndone,urls.size(),rv,dt.count(),
+                          FormatDuration(TMath::Max(eta,0.0)).Data(),urls[i].c_str()) << std::endl;
+      }
+      
+      if (rv<0)
+      {
+        out << Form("echo \"xrd %s rm %s\"",hosts[i].c_str(),files[i].c_str()) << std::endl;
+        
+        out << "xrd " << hosts[i] << " rm " << files[i] << std::endl;
+        
+        ++nbad;
+      }
+    });
+  };
   
-  AFWebMaker wm("","",u.GetFile(),0);
+  // pick the files to be checked (all of them unless sampling)
+  std::vector<std::size_t> sample = SampleFiles(urls.size(),fSampleFileFraction,fSampleSeed);
   
-  for ( Int_t i = 0; i < nworkers; ++i )
+  checkFiles(sample,fSampleEntryFraction);
+  
+  if ( IsSampling() )
   {
-    TSlaveInfo* slave = static_cast<TSlaveInfo*>(list->At(i));
+    Int_t nsampledBad = nbad;
+    Double_t low, high;
     
-    std::vector<std::string> lines;
+    WilsonInterval(nsampledBad,sample.size(),low,high);
     
-    s = "";
+    std::cout << std::string(80,'_') << std::endl;
+    std::cout << Form("Sampled %lu files out of %lu (%g of the entries) : %d bad",
+                      sample.size(),urls.size(),fSampleEntryFraction,nsampledBad) << std::endl;
+    std::cout << Form("Estimated corruption rate %5.2f %% (95%% CL : %5.2f - %5.2f %%), i.e. %d bad files out of %lu (%d - %d)",
+                      sample.empty() ? 0.0 : nsampledBad*100.0/sample.size(),low*100,high*100,
+                      sample.empty() ? 0 : TMath::Nint(nsampledBad*1.0*urls.size()/sample.size()),urls.size(),
+                      TMath::Nint(low*urls.size()),TMath::Nint(high*urls.size())) << std::endl;
     
-    for ( std::set<std::string>::const_iterator it = topdirs.begin(); it != topdirs.end(); ++it )
+    // escalate to a full check of the runs and servers where sampled failures cluster
+    std::map<std::string,int> badPerRun;
+    std::map<std::string,int> badPerHost;
+    
+    for ( std::vector<std::size_t>::size_type j = 0; j < sample.size(); ++j )
     {
-      std::cout << "Looking for files for slave " << slave->fHostName << " " << slave->GetOrdinal()
-      << " in directory " << it->c_str() << std::endl;
-      
-      TString cmd;
-      
-      cmd.Form(".! find %s -type %c -exec stat -L -c '%%s %%Y %%n' {} \\; | grep -v lock | grep -v LOCK",
-               it->c_str(),FileTypeToLookFor());
-      
-      //      std::cout << cmd.Data() << std::endl;
-      
-      s += GetStringFromExec(cmd.Data(),slave->GetOrdinal());
+      if ( results[sample[j]] < 0 )
+      {
+        ++badPerRun[RunOfFile(files[sample[j]])];
+        ++badPerHost[hosts[sample[j]]];
+      }
     }
     
-    TObjArray* b = s.Tokenize("\n");
-    TIter next2(b);
+    std::set<std::string> runs;
+    std::set<std::string> servers;
     
-    while ( ( os = static_cast<TObjString*>(next2())) )
+    for ( std::map<std::string,int>::const_iterator it = badPerRun.begin(); it != badPerRun.end(); ++it )
     {
-      lines.push_back(os->String().Data());
+      if ( it->second >= fSampleEscalation && it->first != "unknown" )
+      {
+        std::cout << "Escalating to a full check of run " << it->first << " (" << it->second << " sampled failures)" << std::endl;
+        runs.insert(it->first);
+      }
     }
     
-    delete b;
+    for ( std::map<std::string,int>::const_iterator it = badPerHost.begin(); it != badPerHost.end(); ++it )
+    {
+      if ( it->second >= fSampleEscalation )
+      {
+        std::cout << "Escalating to a full check of server " << it->first << " (" << it->second << " sampled failures)" << std::endl;
+        servers.insert(it->first);
+      }
+    }
+    
+    std::vector<std::size_t> escalated;
+    
+    for ( std::size_t i = 0; i < urls.size(); ++i )
+    {
+      if ( runs.count(RunOfFile(files[i])) || servers.count(hosts[i]) )
+      {
+        // files already fully checked need not be done again
+        if ( !checked[i] || ( fSampleEntryFraction < 1.0 && results[i] >= 0 ) )
+        {
+          escalated.push_back(i);
+        }
+      }
+    }
     
-    wm.FillFileInfoMap(lines,slave->fHostName.Data());
+    if (!escalated.empty())
+    {
+      std::cout << "Fully checking " << escalated.size() << " more files" << std::endl;
+      checkFiles(escalated,1.0);
+    }
   }
   
-  wm.GenerateReports();
-}
-
-//______________________________________________________________________________
-TString VAF::GetFileType(const char* path) const
-{
-  TString file = gSystem->BaseName(path);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
   
-  if ( file.Contains("FILTER_RAWMUON") )
-  {
-    file = "FILTER_RAWMUON";
-  }
+  Double_t cumulated(0.0);
+  Long64_t totalSize(0);
   
-  if ( file.BeginsWith("15000") )
-  {
-    file = "RAW 2015";
-  }
+  std::cout << std::string(80,'_') << std::endl;
+  std::cout << "Time spent per file :" << std::endl;
   
-  if ( file.BeginsWith("14000") )
-  {
-    file = "RAW 2014";
-  }
+  std::vector<std::string>::size_type nchecked(0);
   
-  if ( file.BeginsWith("13000") )
+  for ( std::vector<std::string>::size_type i = 0; i < urls.size(); ++i )
   {
-    file = "RAW 2013";
+    if (!checked[i]) continue;
+    
+    ++nchecked;
+    
+    std::cout << Form("%7.1f s %8.2f MB/s %10d %s",durations[i],
+                      durations[i] > 0 ? sizes[i]/byte2MB/durations[i] : 0.0,
+                      results[i],urls[i].c_str()) << std::endl;
+    cumulated += durations[i];
+    totalSize += sizes[i];
   }
   
-  if ( file.BeginsWith("12000") )
-  {
-    file = "RAW 2012";
-  }
+  std::cout << std::string(80,'_') << std::endl;
+  std::cout << Form("%lu files (%7.2f GB) checked in %7.1f s (%7.1f s cumulated over %d threads)",
+                    nchecked,totalSize/byte2GB,elapsed.count(),cumulated,TMath::Max(Parallelism(),1)) << std::endl;
   
-  if ( file.BeginsWith("11000") )
+  if ( nskipped > 0 )
   {
-    file = "RAW 2011";
+    std::cout << nskipped << " files were not checked again as they are unchanged since their journaled check" << std::endl;
   }
   
-  if ( file.BeginsWith("10000") )
-  {
-    file = "RAW 2010";
-  }
+  std::cout << "nbad=" << nbad << std::endl;
   
-  return file;
+  return nbad;
 }
 
 //______________________________________________________________________________
-void VAF::GetOneDataSetSize(const char* dsname, Int_t& nFiles, Int_t& nCorruptedFiles, Long64_t& size, Bool_t showDetails)
+void VAF::ClearPackages()
 {
-  // compute the size of one dataset
-  
-  nFiles = 0;
-  nCorruptedFiles = 0;
-  size = 0;
-  
   if ( Connect() )
   {
-    TFileCollection* fc = gProof->GetDataSet(dsname);
-    
-    if (!fc) return;
-    
-    nFiles = fc->GetNFiles();
-    nCorruptedFiles = fc->GetNCorruptFiles();
-    size = fc->GetTotalSize();
-    
-    if (showDetails)
-    {
-      cout << Form("%s nfiles = %5d | ncorrupted = %5d | size = %7.2f GB",dsname,nFiles,nCorruptedFiles,size/byte2GB) << endl;
-    }
+    gProof->ClearPackages();
   }
 }
 
-//__________________________________________________________________________________________________
-void VAF::GetSearchAndBaseName(Int_t runNumber, const char* basename,
-                               const char* what,
-                               const char* dataType,
-                               const char* esdpass,
-                               Int_t aodPassNumber,
-                               TString& mbasename, TString& search) const
+//______________________________________________________________________________
+void VAF::UpdateConnectString()
 {
-  TString sbasename(basename);
-  TString swhat(what);
-  TString sdatatype(dataType);
-  
-  mbasename = "";
-  search = "";
-  
-  if ( IsPrivateProduction() && !sbasename.BeginsWith("/alice/data") && !sbasename.BeginsWith("/alice/sim") )
+  if ( fConnect.Contains("@")) return;
+
+  if ( fConnect.Contains("pod") ) 
+{
+fConnect="pod://";
+return;
+}  
+  std::ifstream in(Form("/tmp/gclient_token_%d",gSystem->GetUid()));
+  TString s;
+  TString user;
+  while (s.ReadLine(in))
   {
-    if ( IsSimpleRunNumbers() )
-    {
-      mbasename = Form("%s/%d",basename,runNumber);
-    }
-    else
-    {
-      mbasename = Form("%s/%09d",basename,runNumber);
-    }
-    if ( PrivateProduction().Contains("ROBERTA") )
+    if (s.BeginsWith("User"))
     {
-      mbasename += "/1";
+      TObjArray* a = s.Tokenize('=');
+      user = static_cast<TObjString*>(a->Last())->String();
+      user = user(1,user.Length()-1);
+      delete a;
+      break;
     }
-    search = swhat.Data();
   }
-  else
+  if (user.Length())
   {
-    if ( sdatatype.Contains("ESD") )
-    {
-      if ( sbasename.BeginsWith("/alice/sim") )
-      {
-        mbasename.Form("%s/%d",basename,runNumber);
-      }
-      else if ( ( ( swhat.Contains("_Outer") || swhat.Contains("_Barrel") ) && TString(esdpass) == "cpass1" )
-               || TString(esdpass) == "pass1" )
-      {
-        mbasename=Form("%s/%09d/%s/*.*",basename,runNumber,esdpass);
-      }
-      else
-      {
-        mbasename=Form("%s/%09d/ESDs/%s/*.*",basename,runNumber,esdpass);
-      }
-      search = swhat.Data();
-    }
-    if ( sdatatype.Contains("AOD") || sdatatype.Contains("STAT") )
-    {
-      if ( sbasename.BeginsWith("/alice/sim") )
-      {
-        //        	/alice/sim/2011/LHC11e1_rawocdb/139517/AOD068
-        if ( aodPassNumber>0 )
-        {
-          mbasename = Form("%s/%s/%d/AOD%03d/*",basename,esdpass,runNumber,aodPassNumber);
-        }
-        else if ( aodPassNumber == 0 )
-        {
-          mbasename = Form("%s/%s/%d/AOD/*",basename,esdpass,runNumber);
-        }
-        else
-        {
-          mbasename = Form("%s/%d/*/",basename,runNumber);
-        }
-        search = swhat.Data();
-      }
-      else if (aodPassNumber>=0)
-      {
-        if ( aodPassNumber==0)
-        {
-          mbasename = Form("%s/%09d/ESDs/%s/AOD/*",basename,runNumber,esdpass);
-        }
-        else if ( MergedOnly() )
-        {
-          mbasename = Form("%s/%09d/%s/AOD%03d/*",basename,runNumber,esdpass,aodPassNumber);
-          //            mbasename = Form("%s/%09d/ESDs/%s/AOD%03d/AOD/*",basename,runNumber,esdpass,aodPassNumber);
-        }
-        else
-        {
-          mbasename = Form("%s/%09d/ESDs/%s/AOD%03d",basename,runNumber,esdpass,aodPassNumber);
-        }
-        search = swhat.Data();
-      }
-      else if ( aodPassNumber == -1 )
-      {
-        // aods in same dir as ESDs (e.g. LHC11h_HLT)
-        mbasename = Form("%s/%09d/ESDs/%s/*.*",basename,runNumber,esdpass);
-        search = swhat.Data();
-      }
-      else if ( aodPassNumber == -2 )
-      {
-        // aods in their own directory (not under runNumber/ESDs/pass... but directly under runNumber/pass... e.g. LHC12c pass1...)
-        mbasename = Form("%s/%09d/%s/AOD/*",basename,runNumber,esdpass);
-        search = swhat.Data();        
-      }
-      else if ( aodPassNumber == -3 )
-      {
-        // aods in the same directory as the rest, but without "ESDs" in the path
-        mbasename = Form("%s/%09d/%s/*",basename,runNumber,esdpass);
-        search = swhat.Data();
-        
-      }
-
-    }
-    if ( sdatatype.Contains("RAW") )
-    {
-      mbasename=Form("%s/%09d/raw",basename,runNumber);
-      search = Form("*%09d*.root",runNumber);
-    }
+    TString tmp = fConnect;
+    fConnect = user;
+    fConnect += "@";
+    fConnect += tmp;
   }
+}
+
+
+//______________________________________________________________________________
+Bool_t VAF::Connect(const char* option)
+{
+  // FIXME: how to tell, for an existing connection, which option was used ?
   
-  mbasename.ReplaceAll("///","/");
-  mbasename.ReplaceAll("//","/");
+  if ( gProof ) return kTRUE;
   
-  //  cout << Form("basename=%s search=%s",mbasename.Data(),search.Data()) << endl;
+  if ( fConnect.Length()==0 ) return kFALSE;
+  
+  UpdateConnectString();
+  
+  TProof::Open(fConnect.Data(),option);
+  
+  return (gProof != 0x0);
 }
 
 //______________________________________________________________________________
-TString VAF::GetStringFromExec(const char* cmd, const char* ord)
+void VAF::CompareRunLists(const char* runlist1, const char* runlist2)
 {
-  // Execute a command on each Proof worker and get back the result as a (possibly giant)
-  // string
+  std::vector<int> v1, v2;
   
-  TString rv;
+  ReadIntegers(runlist1,v1);
+  ReadIntegers(runlist2,v2);
   
-  if (Connect("workers=1x"))
+  cout << "Only in v1:" << endl;
+  
+  int n(0);
+  
+  for ( std::vector<int>::size_type i = 0; i < v1.size(); ++i )
   {
-    gProof->Exec(cmd,ord,kTRUE);
-    
-    TMacro* macro = gProof->GetMacroLog();
-    
-    TIter next(macro->GetListOfLines());
-    TObjString* s;
-    TString fullLine;
-    
-    while ( ( s = static_cast<TObjString*>(next())) )
+    int run = v1[i];
+    std::vector<int>::const_iterator it = std::find(v2.begin(),v2.end(),run);
+    if ( it == v2.end() )
     {
-      fullLine += s->String();
+      cout << run << endl;
+      ++n;
     }
-    
-    TObjArray* l = fullLine.Tokenize("\n");
-    TObjString* s2;
-    TIter next2(l);
-    
-    while ( ( s2 = static_cast<TObjString*>(next2())) )
+  }
+  cout << n << " runs" << endl;
+  
+  n = 0;
+  
+  cout << "Only in v2:" << endl;
+  for ( std::vector<int>::size_type i = 0; i < v2.size(); ++i )
+  {
+    int run = v2[i];
+    std::vector<int>::const_iterator it = std::find(v1.begin(),v1.end(),run);
+    if ( it == v1.end() )
     {
-      if ( s2->String().Contains("No such file or directory") ) continue;
-      rv += s2->String();
-      rv += "\n";
+      cout << run << endl;
+      ++n;
     }
   }
+  cout << n << " runs" << endl;
   
-  return rv;
 }
 
+
 //______________________________________________________________________________
-void VAF::GroupDatasets()
+void VAF::CopyFromRemote(const char* txtfile, Int_t nthreads, Int_t maxPerHost, Int_t maxRetries)
 {
-  if (!Connect()) return;
-  
-  TList list;
-  
-  GetDataSetList(list);
+  /// Copy a list of remote urls locally, keeping the absolute path
+  /// (the destination local directory must exist and be writeable, of course)
+  /// See ::CopyFromRemote for the meaning of the parameters.
   
-  GroupDatasets(list);
+  ::CopyFromRemote(txtfile,nthreads,maxPerHost,maxRetries);
 }
 
-//______________________________________________________________________________
-void VAF::GroupDatasets(const TList& dslist)
+//__________________________________________________________________________________________________
+VAF* VAF::Create(const char* af)
 {
-  std::map<std::string, std::list<std::string> > groups;
-  std::map<std::string, Long64_t > groupSize;
-  std::map<Long64_t, std::list<std::string> > groupOrderedBySize;
+  TString envFile(gSystem->ExpandPathName("$HOME/.aaf"));
   
-  TIter next(&dslist);
-  TObjString* str;
+  if ( gSystem->AccessPathName(envFile.Data()) )
+  {
+    std::cerr << "Cannot work without an environment file. Please make a $HOME/.aaf file !" << std::endl;
+    throw;
+  }
   
-  while ( (str = static_cast<TObjString*>(next())) )
+  TEnv env;
+  
+  env.ReadFile(envFile,kEnvAll);
+  
+  TString afMaster = env.GetValue(Form("%s.master",af),"unknown");
+  Bool_t afDynamic = env.GetValue(Form("%s.dynamic",af),kFALSE);
+  
+  VAF* vaf(0x0);
+  
+  if ( afMaster != "unknown" )
   {
-    TString sname(str->String());
-    sname = sname.Strip();
+    std::string className("AFStatic");
+    
+    if ( afDynamic )
+    {
+      className = "AFDynamic";
+    }
+    
+    TClass* c = TClass::GetClass(className.c_str());
+    
+    if (!c)
+    {
+      std::cerr << Form("Cannot get class %s",className.c_str()) << std::endl;
+      return 0x0;
+    }
+    
+    TMethodCall call;
+    
+    call.InitWithPrototype(c,className.c_str(),"char*");
+    
+    Long_t returnLong(0x0);
+    
+    Long_t params[] = { (Long_t)(&(afMaster.Data()[0])) };
+    call.SetParamPtrs((void*)(params));
+    call.Execute((void*)(0x0),returnLong);
+    
+    if (!returnLong)
+    {
+      std::cout << "Cannot create an AF of class " << className << std::endl;
+      return 0x0;
+    }
+    
+    vaf = reinterpret_cast<VAF*> (returnLong);
+  }
+  else
+  {
+    std::cerr << "Could not get master information for AF named " << af << std::endl;
+  }
+  
+  if ( vaf )
+  {
+    TString homeDir = env.GetValue(Form("%s.home",af),"/home/PROOF-AAF");
+    TString logDir = env.GetValue(Form("%s.log",af),"/home/PROOF-AAF");
+    
+    vaf->SetHomeAndLogDir(homeDir.Data(),logDir.Data());
+    
+    TString fileType = env.GetValue(Form("%s.filetype",af),"f");
+    
+    vaf->SetFileTypeToLookFor(fileType[0]);
+    
+    TString cacheDir = env.GetValue(Form("%s.cache",af),Form("$HOME/.aafu/cache/%s",af));
+    Int_t cacheTTL = env.GetValue(Form("%s.cachettl",af),3600);
+    
+    vaf->SetCache(gSystem->ExpandPathName(cacheDir.Data()),cacheTTL);
+    
+    vaf->SetParallelism(env.GetValue(Form("%s.parallelism",af),4));
+    
+    vaf->SetMergeFanIn(env.GetValue(Form("%s.mergefanin",af),0));
+    
+    vaf->SetMergeLimits(env.GetValue(Form("%s.mergereadsperserver",af),2),
+                        env.GetValue(Form("%s.mergewrites",af),2));
+    
+    vaf->SetMergeOnServers(env.GetValue(Form("%s.mergeonservers",af),0));
+    
+    TString journalDir = env.GetValue(Form("%s.journal",af),Form("$HOME/.aafu/journal/%s",af));
+    
+    vaf->SetJournalDir(gSystem->ExpandPathName(journalDir.Data()));
+    
+    TString checkLevel = env.GetValue(Form("%s.checklevel",af),"full");
+    
+    vaf->SetCheckLevel( checkLevel == "fast" ? kFastCheck : kFullCheck );
+    
+    vaf->SetSampling(env.GetValue(Form("%s.samplefiles",af),1.0),
+                     env.GetValue(Form("%s.sampleentries",af),1.0),
+                     env.GetValue(Form("%s.sampleseed",af),4357),
+                     env.GetValue(Form("%s.sampleescalation",af),2));
+  }
+  
+  return vaf;
+}
+
+//______________________________________________________________________________
+void VAF::CreateDataSets(const char* runlist,
+                         const char* dataType,
+                         const char* esdpass,
+                         int aodPassNumber,
+                         const char* basename,
+                         Int_t fileLimit)
+{
+  std::vector<int> runs;
+  
+  ReadIntegers(runlist,runs);
+  
+  CreateDataSets(runs,dataType,esdpass,aodPassNumber,basename,fileLimit);
+}
+
+//______________________________________________________________________________
+void VAF::CreateDataSets(Int_t runNumber,
+                         const char* dataType,
+                         const char* esdpass,
+                         int aodPassNumber,
+                         const char* basename,
+                         Int_t fileLimit)
+{
+  std::vector<int> runs;
+  
+  runs.push_back(runNumber);
+  
+  CreateDataSets(runs,dataType,esdpass,aodPassNumber,basename,fileLimit);
+}
+
+//______________________________________________________________________________
+TString VAF::DecodeDataType(const char* dataType, TString& what, TString& treeName, TString& anchor, Int_t aodPassNumber) const
+{
+  // dataType is case insensitive and will be converted into []
+  //
+  // *stat* -> [EventStat_temp.root]
+  // *zip* -> [root_archive.zip] or [AOD_archive.zip]
+  // *esd* -> [AliESDs.root]
+  // *esd_outer* -> [AliESDs_Outer.root]
+  // *esd_barrel* -> [AliESDs_Barrel.root]
+  // *aod* -> [AliAOD.root]
+  // *aodmuon* -> [AliAOD.Muons.root]
+  // *aoddimuon* -> [AliAOD.Dimuons.root]
+  // *esd.tag* -> [ESD.tag]
+  // *raw* -> [raw data file]
+  
+  TString sdatatype(dataType);
+  sdatatype.ToUpper();
+  TString defaultWhat("unknown");
+  
+  what = defaultWhat;
+  
+  treeName = "";
+  
+  anchor="";
+  
+  if ( sdatatype.Contains("ESD.TAG") )
+  {
+    what = "*ESD.tag.root";
+  }
+  else if ( sdatatype.Contains("ESD_OUTER") )
+  {
+    what = "AliESDs_Outer.root";
+    treeName="/esdTree";
+  }
+  else if ( sdatatype.Contains("ESD_BARREL") )
+  {
+    what = "AliESDs_Barrel.root";
+    treeName="/esdTree";
+  }
+  else if ( sdatatype.Contains("ESD") )
+  {
+    what = "AliESDs.root";
+    treeName="/esdTree";
+  }
+  else if ( sdatatype.Contains("AODMU") )
+  {
+    what = "AliAOD.Muons.root";
+    treeName="/aodTree";
+  }
+  else if ( sdatatype.Contains("AODDIMU") )
+  {
+    what = "AliAOD.Dimuons.root";
+    treeName="/aodTree";
+  }
+  else if ( sdatatype.Contains("AODHF") )
+  {
+    what = "AliAOD.VertexingHF.root";
+    treeName = "/aodTree";
+  }
+  else if ( sdatatype.Contains("AODJE") )
+  {
+    what = "AliAOD.Jets.root";
+    treeName = "/aodTree";
+  }
+  else if ( sdatatype.Contains("AOD") )
+  {
+    what = "AliAOD.root";
+    treeName = "/aodTree";
+  }
+  else if ( sdatatype.Contains("STAT") )
+  {
+    what = "EventStat_temp.root";
+  }
+  else if ( sdatatype.Contains("RAW") )
+  {
+    what = "*.root";
+  }
+  if ( sdatatype.Contains("ZIP") )
+  {
+    if ( what != defaultWhat )
+    {
+      anchor = what;
+      anchor.ReplaceAll("ZIP","");
+    }
+    //    else
+    //    {
+    //      cout << "type=" << dataType << " is not enough to know what to look for..." << endl;
+    //      return 0x0;
+    //    }
+    if ( sdatatype.Contains("AOD") )
+    {
+      //      if ( aodPassNumber < 0 )
+      //      {
+      //        what = "aod_archive.zip";
+      //      }
+      //      else
+      if ( aodPassNumber == 0 )
+      {
+        what = "aod_archive.zip";
+        //        what = "AOD_archive.zip";
+      }
+      else
+      {
+        what = "root_archive.zip";
+      }
+    }
+    else
+    {
+      what = "root_archive.zip";
+    }
+  }
+  
+  return sdatatype;
+}
+
+//______________________________________________________________________________
+TFileCollection* VAF::GetCachedDataSet(const char* dsname) const
+{
+  /// Get one dataset from the local cache, if it's there, not older than CacheTTL(),
+  /// and ForceUpdate() is not set. Return 0x0 otherwise.
+  /// The returned collection belongs to the caller.
+  
+  if ( fCacheTTL <= 0 || fCacheDir.Length() == 0 || fForceUpdate ) return 0x0;
+  
+  TString cacheFile(CacheFileName(dsname));
+  
+  FileStat_t buf;
+  
+  if ( gSystem->GetPathInfo(cacheFile.Data(),buf) || time(0) - buf.fMtime >= fCacheTTL ) return 0x0;
+  
+  std::unique_ptr<TFile> f(TFile::Open(cacheFile.Data()));
+  
+  return f ? dynamic_cast<TFileCollection*>(f->Get("dataset")) : 0x0;
+}
+
+//______________________________________________________________________________
+TFileCollection* VAF::GetDataSet(const char* dsname, Bool_t refresh)
+{
+  /// Get one dataset, from the local cache if it's there and not older than
+  /// CacheTTL(), from the master otherwise (in which case the cache is updated).
+  /// If refresh is true (or ForceUpdate() is set) the cache is bypassed,
+  /// and for dynamic datasets the master is asked to update its own cache as well.
+  /// The returned collection belongs to the caller.
+  
+  if ( !refresh )
+  {
+    TFileCollection* fc = GetCachedDataSet(dsname);
+    
+    if ( fc ) return fc;
+  }
+  
+  if (!Connect()) return 0x0;
+  
+  TString query(dsname);
+  
+  if ( ( refresh || fForceUpdate ) && fIsDynamicDataSet && !query.Contains("ForceUpdate") )
+  {
+    query += ";ForceUpdate";
+  }
+  
+  TFileCollection* fc = gProof->GetDataSet(query.Data());
+  
+  if ( fc && fCacheTTL > 0 && fCacheDir.Length() > 0 )
+  {
+    gSystem->mkdir(fCacheDir.Data(),kTRUE);
+    
+    // write under a temporary name first, so a concurrent reader never sees a partial file
+    TString cacheFile(CacheFileName(dsname));
+    TString tmpFile(Form("%s.%d",cacheFile.Data(),gSystem->GetPid()));
+    
+    std::unique_ptr<TFile> f(TFile::Open(tmpFile.Data(),"recreate"));
+    
+    if ( f )
+    {
+      fc->Write("dataset");
+      f->Close();
+      gSystem->Rename(tmpFile.Data(),cacheFile.Data());
+    }
+  }
+  
+  return fc;
+}
+
+//______________________________________________________________________________
+void VAF::GetDataSetList(TList& list, const char* path)
+{
+  list.SetOwner(kTRUE);
+  list.Clear();
+  
+  if ( Connect() )
+  {
+    TMap* datasets = gProof->GetDataSets(path, ":lite:");
+    
+    if (!datasets)
+    {
+      return;
+    }
+    
+    datasets->SetOwnerKeyValue();  // important to avoid leaks!
+    TIter dsIterator(datasets);
+    TObjString* dsName;
+    
+    while ((dsName = static_cast<TObjString *>(dsIterator.Next())))
+    {
+      list.Add(new TObjString(*dsName));
+    }
+  }
+}
+
+//______________________________________________________________________________
+void VAF::GetDataSetSummaries(const TList& dsnames, TMap& summaries, Bool_t refresh)
+{
+  /// Get the summary (number of files, of staged and corrupted files, total size)
+  /// of each dataset in dsnames, in one single exchange with the master.
+  ///
+  /// The summaries are TFileCollection objects without file list, keyed by
+  /// the dataset names as given in dsnames. Names may be either full (/group/user/name)
+  /// or just the dataset name. Datasets found in the local cache are not
+  /// requested from the master at all, and those not known to the master listing
+  /// (e.g. dynamic dataset queries) are retrieved one by one.
+  /// With refresh, the cache is bypassed (and the cached datasets concerned updated
+  /// or invalidated).
+  
+  summaries.SetOwnerKeyValue();
+  summaries.Clear();
+  
+  TList missing;
+  TIter next(&dsnames);
+  TObjString* str;
+  
+  std::vector<TObjString*> names;
+  std::set<std::string> seen;
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
+  {
+    TString dsname(str->String().Strip(TString::kBoth));
+    
+    if ( dsname.Length() == 0 || !seen.insert(dsname.Data()).second ) continue;
+    
+    names.push_back(str);
+  }
+  
+  // the cached datasets are read concurrently (they are local files, not master queries)
+  std::vector<TFileCollection*> cached(names.size(),static_cast<TFileCollection*>(0x0));
+  
+  if (!refresh)
+  {
+    AFParallel::ForEach(names.size(),Parallelism(),[&](std::size_t i)
+    {
+      cached[i] = GetCachedDataSet(names[i]->String().Strip(TString::kBoth).Data());
+    });
+  }
+  
+  for ( std::vector<TObjString*>::size_type i = 0; i < names.size(); ++i )
+  {
+    if ( cached[i] )
+    {
+      summaries.Add(new TObjString(names[i]->String().Strip(TString::kBoth)),cached[i]);
+    }
+    else
+    {
+      missing.Add(names[i]);
+    }
+  }
+  
+  if ( missing.GetSize() == 0 || !Connect() ) return;
+  
+  TMap* datasets = gProof->GetDataSets("/*/*/*", ":lite:");
+  
+  std::map<std::string,TFileCollection*> byName;
+  
+  if ( datasets )
+  {
+    datasets->SetOwnerKeyValue();  // important to avoid leaks!
+    TIter dsIterator(datasets);
+    TObjString* dsName;
+    
+    while ((dsName = static_cast<TObjString *>(dsIterator.Next())))
+    {
+      TFileCollection* fc = dynamic_cast<TFileCollection*>(datasets->GetValue(dsName));
+      
+      if (!fc) continue;
+      
+      std::string fullname(dsName->String().Data());
+      std::string name(fullname.substr(fullname.find_last_of('/')+1));
+      
+      byName[fullname] = fc;
+      
+      // short names are only usable if they are not ambiguous
+      byName[name] = byName.count(name) ? 0x0 : fc;
+    }
+  }
+  
+  TIter nextMissing(&missing);
+  Int_t nmissing(0);
+  
+  while ( ( str = static_cast<TObjString*>(nextMissing()) ) )
+  {
+    TString dsname(str->String().Strip(TString::kBoth));
+    
+    std::map<std::string,TFileCollection*>::const_iterator it = byName.find(dsname.Data());
+    
+    TFileCollection* fc(0x0);
+    
+    if ( it != byName.end() && it->second )
+    {
+      fc = static_cast<TFileCollection*>(it->second->Clone());
+      
+      if ( refresh ) InvalidateCache(dsname.Data());
+    }
+    else
+    {
+      fc = GetDataSet(dsname.Data(),refresh);
+      ++nmissing;
+    }
+    
+    if ( fc )
+    {
+      summaries.Add(new TObjString(dsname),fc);
+    }
+  }
+  
+  if ( nmissing )
+  {
+    std::cout << nmissing << " dataset(s) had to be queried individually" << std::endl;
+  }
+  
+  delete datasets;
+}
+
+//______________________________________________________________________________
+void VAF::GetDataSetsSize(const char* dsList, Bool_t showDetails)
+{
+  // compute the size of a list of datasets
+  
+  ifstream in(gSystem->ExpandPathName(dsList));
+	char line[1024];
+  
+  TList list;
+  list.SetOwner(kTRUE);
+  
+	while ( in.getline(line,1024,'\n') )
+	{
+    list.Add(new TObjString(line));
+  }
+  
+  TMap summaries;
+  
+  GetDataSetSummaries(list,summaries);
+  
+  Int_t totalFiles(0);
+  Int_t totalCorruptedFiles(0);
+  Long64_t totalSize(0);
+  
+  Int_t n(0);
+  
+  // per group (i.e. dataset name without run number, see GroupDatasets) summary
+  std::map<std::string,Int_t> groupDataSets;
+  std::map<std::string,Int_t> groupFiles;
+  std::map<std::string,Int_t> groupCorruptedFiles;
+  std::map<std::string,Long64_t> groupSize;
+  
+  TIter next(&list);
+  TObjString* str;
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
+  {
+    TFileCollection* fc = static_cast<TFileCollection*>(summaries.GetValue(str->String().Strip(TString::kBoth).Data()));
+    
+    Int_t nFiles = fc ? fc->GetNFiles() : 0;
+    Int_t nCorruptedFiles = fc ? fc->GetNCorruptFiles() : 0;
+    Long64_t size = fc ? fc->GetTotalSize() : 0;
+    
+    if (showDetails && fc)
+    {
+      cout << Form("%s nfiles = %5d | ncorrupted = %5d | size = %7.2f GB",str->String().Data(),nFiles,nCorruptedFiles,size/byte2GB) << endl;
+    }
+    
+    ++n;
+    totalFiles += nFiles;
+    totalCorruptedFiles += nCorruptedFiles;
+    totalSize += size;
+    
+    std::string group = DataSetGroup(str->String().Strip(TString::kBoth));
+    
+    ++groupDataSets[group];
+    groupFiles[group] += nFiles;
+    groupCorruptedFiles[group] += nCorruptedFiles;
+    groupSize[group] += size;
+  }
+  
+  if (showDetails)
+  {
+    cout << std::string(80,'_') << endl;
+    
+    for ( std::map<std::string,Int_t>::const_iterator it = groupDataSets.begin(); it != groupDataSets.end(); ++it )
+    {
+      cout << Form("%s ndatasets=%3d nfiles = %5d | ncorrupted = %5d | size = %7.2f GB",it->first.c_str(),it->second,
+                   groupFiles[it->first],groupCorruptedFiles[it->first],groupSize[it->first]/byte2GB) << endl;
+    }
+    
+    cout << std::string(80,'_') << endl;
+  }
+  
+  cout << Form("ndatasets=%3d nfiles = %5d | ncorrupted = %5d | size = %7.2f GB",n,totalFiles,totalCorruptedFiles,totalSize/byte2GB) << endl;
+}
+
+//______________________________________________________________________________
+void VAF::EmergencyRemoval()
+{
+  /// Emergency removal of files being staged...
+  
+  if (!Connect("workers=1x")) return;
+
+  TString s = GetStringFromExec(".! find /data/alice/data/2011/LHC11h/000170387/raw -name *.root");
+  
+  TObjArray* a = s.Tokenize("\n");
+  TObjString* os;
+  TIter next(a);
+  
+  TObjArray cmds;
+  cmds.SetOwner(kTRUE);
+  
+  while ( ( os = static_cast<TObjString*>(next())) )
+  {
+    TString line = os->String();
+    
+    if ( !line.Contains("LHC11h") ) continue;
+    
+    TString cmd;
+    
+    line.ReplaceAll("/data/alice","/alice");
+    
+    cmd.Form("xrd nansafmaster2 rm %s",line.Data());
+    
+    cmds.Add(new TObjString(cmd));
+  }
+  
+  delete a;
+
+  CloseConnection();
+  
+  Connect("masteronly");
+  
+  TIter nextCmd(&cmds);
+  
+  while ( ( os = static_cast<TObjString*>(nextCmd())) )
+  {
+    std::cout << os->String().Data() << std::endl;
+    gProof->Exec(Form(".! %s",os->String().Data()));
+  }
+  
+  CloseConnection();
+
+}
+
+//______________________________________________________________________________
+void VAF::CloseConnection()
+{
+  if ( gProof )
+  {
+    gProof->Close("s");
+    delete gProof;
+    gProof = 0x0;
+  }
+}
+
+//______________________________________________________________________________
+void VAF::GenerateReports()
+{
+  // Retrieve the complete list of files on this AF for each worker,
+  // and delegates the actual report generation to AFWebMaker class
+  
+  if (!Connect("workers=1x")) return;
+  
+  TUrl u(gProof->GetDataPoolUrl());
+  
+  TList* list = gProof->GetListOfSlaveInfos();
+  Int_t nworkers = list->GetSize();
+  
+  std::string pool(u.GetFile());
+  
+  // to overcome possible limitation in the size of the log file which is used to
+  // transmit back the macrolog, we split the request in several find commands.
+  // The subtrees to be scanned (e.g. /alice/data/2015/LHC15o, /alice/sim/2016/LHC16g1)
+  // are discovered on all workers, and grouped in chunks of roughly equal cost,
+  // based on the number of files each subtree had during the previous scan.
+  
+  std::set<std::string> subtrees;
+  
+  TString s = GetStringFromExec(Form(".! find %s/alice -mindepth %d -maxdepth %d -type d",
+                                     pool.c_str(),(Int_t)kScanDepth-1,(Int_t)kScanDepth-1));
+  
+  TObjArray* a = s.Tokenize("\n");
+  TObjString* os;
+  TIter next(a);
+  
+  while ( ( os = static_cast<TObjString*>(next())) )
+  {
+    TString dir(os->String().Strip(TString::kBoth));
+    if ( !dir.BeginsWith(pool.c_str()) ) continue;
+    subtrees.insert(dir.Data()+pool.size());
+  }
+  
+  delete a;
+  
+  std::map<std::string,Long64_t> costs;
+  
+  ReadScanCosts(costs);
+  
+  std::vector<ScanChunk> chunks;
+  
+  PartitionScan(subtrees,costs,nworkers,chunks);
+  
+  std::cout << subtrees.size() << " subtrees to be scanned in " << chunks.size() << " chunks" << std::endl;
+  
+  std::map<std::string,Long64_t> newCosts;
+  
+  AFWebMaker wm("","",u.GetFile(),0);
+  
+  // each find command runs on all the workers at once, every output line
+  // being prefixed by the name of the host it comes from
+  std::vector<std::string> cmds;
+  TString cmd;
+  
+  // files too shallow to belong to any subtree
+  cmd.Form(".! find %s/alice -maxdepth %d -type %c -exec stat -L -c \"$(hostname -f) %%s %%Y %%n\" {} + | grep -v lock | grep -v LOCK",
+           pool.c_str(),(Int_t)kScanDepth-1,FileTypeToLookFor());
+  cmds.push_back(cmd.Data());
+  
+  // chunks are scanned largest first
+  for ( std::vector<ScanChunk>::size_type c = 0; c < chunks.size(); ++c )
+  {
+    TString dirs;
+    
+    for ( std::vector<std::string>::size_type d = 0; d < chunks[c].fDirs.size(); ++d )
+    {
+      dirs += " ";
+      dirs += pool.c_str();
+      dirs += chunks[c].fDirs[d].c_str();
+    }
+    
+    cmd.Form(".! find %s -type %c -exec stat -L -c \"$(hostname -f) %%s %%Y %%n\" {} + | grep -v lock | grep -v LOCK",
+             dirs.Data(),FileTypeToLookFor());
+    cmds.push_back(cmd.Data());
+  }
+  
+  std::map<std::string,std::vector<std::string> > lines; // per worker host name
+  
+  for ( std::vector<std::string>::size_type c = 0; c < cmds.size(); ++c )
+  {
+    if ( c > 0 )
+    {
+      std::cout << "Looking for files on " << nworkers << " workers in chunk " << c-1 << " ("
+      << chunks[c-1].fDirs.size() << " directories, ~" << chunks[c-1].fCost << " files per worker)" << std::endl;
+    }
+    
+    s = GetStringFromExec(cmds[c].c_str());
+    
+    TObjArray* b = s.Tokenize("\n");
+    TIter next2(b);
+    
+    while ( ( os = static_cast<TObjString*>(next2())) )
+    {
+      std::string line(os->String().Data());
+      std::string::size_type sp = line.find(' ');
+      
+      if ( sp == std::string::npos ) continue;
+      
+      std::string host = line.substr(0,sp);
+      
+      line.erase(0,sp+1);
+      
+      // decoding here is linked to the stat -c command above : size time path
+      std::string::size_type ix = line.find(pool,line.find(' ',line.find(' ')+1));
+      
+      if ( ix != std::string::npos )
+      {
+        std::string subtree = ScanSubtree(line.substr(ix+pool.size()));
+        if ( !subtree.empty() ) ++newCosts[subtree];
+      }
+      
+      lines[host].push_back(line);
+    }
+    
+    delete b;
+  }
+  
+  for ( Int_t i = 0; i < nworkers; ++i )
+  {
+    TSlaveInfo* slave = static_cast<TSlaveInfo*>(list->At(i));
+    std::string name(slave->fHostName.Data());
+    std::vector<std::string> workerLines;
+    
+    // hostname -f and the name PROOF knows the worker by might differ by the domain
+    for ( std::map<std::string,std::vector<std::string> >::const_iterator it = lines.begin(); it != lines.end(); ++it )
+    {
+      if ( SameHost(it->first,name) )
+      {
+        workerLines.insert(workerLines.end(),it->second.begin(),it->second.end());
+      }
+    }
+    
+    wm.FillFileInfoMap(workerLines,slave->fHostName.Data());
+  }
+  
+  WriteScanCosts(newCosts);
+  
+  wm.GenerateReports();
+}
+
+//______________________________________________________________________________
+TString VAF::GetFileType(const char* path) const
+{
+  TString file = gSystem->BaseName(path);
+  
+  if ( file.Contains("FILTER_RAWMUON") )
+  {
+    file = "FILTER_RAWMUON";
+  }
+  
+  if ( file.BeginsWith("15000") )
+  {
+    file = "RAW 2015";
+  }
+  
+  if ( file.BeginsWith("14000") )
+  {
+    file = "RAW 2014";
+  }
+  
+  if ( file.BeginsWith("13000") )
+  {
+    file = "RAW 2013";
+  }
+  
+  if ( file.BeginsWith("12000") )
+  {
+    file = "RAW 2012";
+  }
+  
+  if ( file.BeginsWith("11000") )
+  {
+    file = "RAW 2011";
+  }
+  
+  if ( file.BeginsWith("10000") )
+  {
+    file = "RAW 2010";
+  }
+  
+  return file;
+}
+
+//______________________________________________________________________________
+void VAF::GetOneDataSetSize(const char* dsname, Int_t& nFiles, Int_t& nCorruptedFiles, Long64_t& size, Bool_t showDetails)
+{
+  // compute the size of one dataset
+  
+  nFiles = 0;
+  nCorruptedFiles = 0;
+  size = 0;
+  
+  std::unique_ptr<TFileCollection> fc(GetDataSet(dsname));
+  
+  if (!fc) return;
+  
+  nFiles = fc->GetNFiles();
+  nCorruptedFiles = fc->GetNCorruptFiles();
+  size = fc->GetTotalSize();
+  
+  if (showDetails)
+  {
+    cout << Form("%s nfiles = %5d | ncorrupted = %5d | size = %7.2f GB",dsname,nFiles,nCorruptedFiles,size/byte2GB) << endl;
+  }
+}
+
+//__________________________________________________________________________________________________
+void VAF::GetSearchAndBaseName(Int_t runNumber, const char* basename,
+                               const char* what,
+                               const char* dataType,
+                               const char* esdpass,
+                               Int_t aodPassNumber,
+                               TString& mbasename, TString& search) const
+{
+  TString sbasename(basename);
+  TString swhat(what);
+  TString sdatatype(dataType);
+  
+  mbasename = "";
+  search = "";
+  
+  if ( IsPrivateProduction() && !sbasename.BeginsWith("/alice/data") && !sbasename.BeginsWith("/alice/sim") )
+  {
+    if ( IsSimpleRunNumbers() )
+    {
+      mbasename = Form("%s/%d",basename,runNumber);
+    }
+    else
+    {
+      mbasename = Form("%s/%09d",basename,runNumber);
+    }
+    if ( PrivateProduction().Contains("ROBERTA") )
+    {
+      mbasename += "/1";
+    }
+    search = swhat.Data();
+  }
+  else
+  {
+    if ( sdatatype.Contains("ESD") )
+    {
+      if ( sbasename.BeginsWith("/alice/sim") )
+      {
+        mbasename.Form("%s/%d",basename,runNumber);
+      }
+      else if ( ( ( swhat.Contains("_Outer") || swhat.Contains("_Barrel") ) && TString(esdpass) == "cpass1" )
+               || TString(esdpass) == "pass1" )
+      {
+        mbasename=Form("%s/%09d/%s/*.*",basename,runNumber,esdpass);
+      }
+      else
+      {
+        mbasename=Form("%s/%09d/ESDs/%s/*.*",basename,runNumber,esdpass);
+      }
+      search = swhat.Data();
+    }
+    if ( sdatatype.Contains("AOD") || sdatatype.Contains("STAT") )
+    {
+      if ( sbasename.BeginsWith("/alice/sim") )
+      {
+        //        	/alice/sim/2011/LHC11e1_rawocdb/139517/AOD068
+        if ( aodPassNumber>0 )
+        {
+          mbasename = Form("%s/%s/%d/AOD%03d/*",basename,esdpass,runNumber,aodPassNumber);
+        }
+        else if ( aodPassNumber == 0 )
+        {
+          mbasename = Form("%s/%s/%d/AOD/*",basename,esdpass,runNumber);
+        }
+        else
+        {
+          mbasename = Form("%s/%d/*/",basename,runNumber);
+        }
+        search = swhat.Data();
+      }
+      else if (aodPassNumber>=0)
+      {
+        if ( aodPassNumber==0)
+        {
+          mbasename = Form("%s/%09d/ESDs/%s/AOD/*",basename,runNumber,esdpass);
+        }
+        else if ( MergedOnly() )
+        {
+          mbasename = Form("%s/%09d/%s/AOD%03d/*",basename,runNumber,esdpass,aodPassNumber);
+          //            mbasename = Form("%s/%09d/ESDs/%s/AOD%03d/AOD/*",basename,runNumber,esdpass,aodPassNumber);
+        }
+        else
+        {
+          mbasename = Form("%s/%09d/ESDs/%s/AOD%03d",basename,runNumber,esdpass,aodPassNumber);
+        }
+        search = swhat.Data();
+      }
+      else if ( aodPassNumber == -1 )
+      {
+        // aods in same dir as ESDs (e.g. LHC11h_HLT)
+        mbasename = Form("%s/%09d/ESDs/%s/*.*",basename,runNumber,esdpass);
+        search = swhat.Data();
+      }
+      else if ( aodPassNumber == -2 )
+      {
+        // aods in their own directory (not under runNumber/ESDs/pass... but directly under runNumber/pass... e.g. LHC12c pass1...)
+        mbasename = Form("%s/%09d/%s/AOD/*",basename,runNumber,esdpass);
+        search = swhat.Data();        
+      }
+      else if ( aodPassNumber == -3 )
+      {
+        // aods in the same directory as the rest, but without "ESDs" in the path
+        mbasename = Form("%s/%09d/%s/*",basename,runNumber,esdpass);
+        search = swhat.Data();
+        
+      }
+
+    }
+    if ( sdatatype.Contains("RAW") )
+    {
+      mbasename=Form("%s/%09d/raw",basename,runNumber);
+      search = Form("*%09d*.root",runNumber);
+    }
+  }
+  
+  mbasename.ReplaceAll("///","/");
+  mbasename.ReplaceAll("//","/");
+  
+  //  cout << Form("basename=%s search=%s",mbasename.Data(),search.Data()) << endl;
+}
+
+//______________________________________________________________________________
+TString VAF::GetStringFromExec(const char* cmd, const char* ord)
+{
+  // Execute a command on each Proof worker and get back the result as a (possibly giant)
+  // string
+  
+  TString rv;
+  
+  if (Connect("workers=1x"))
+  {
+    gProof->Exec(cmd,ord,kTRUE);
+    
+    TMacro* macro = gProof->GetMacroLog();
+    
+    TIter next(macro->GetListOfLines());
+    TObjString* s;
+    TString fullLine;
+    
+    while ( ( s = static_cast<TObjString*>(next())) )
+    {
+      fullLine += s->String();
+    }
+    
+    TObjArray* l = fullLine.Tokenize("\n");
+    TObjString* s2;
+    TIter next2(l);
+    
+    while ( ( s2 = static_cast<TObjString*>(next2())) )
+    {
+      if ( s2->String().Contains("No such file or directory") ) continue;
+      rv += s2->String();
+      rv += "\n";
+    }
+  }
+  
+  return rv;
+}
+
+//______________________________________________________________________________
+void VAF::GroupDatasets()
+{
+  if (!Connect()) return;
+  
+  TList list;
+  
+  GetDataSetList(list);
+  
+  GroupDatasets(list);
+}
+
+//______________________________________________________________________________
+void VAF::GroupDatasets(const TList& dslist)
+{
+  std::map<std::string, std::list<std::string> > groups;
+  std::map<std::string, Long64_t > groupSize;
+  std::map<Long64_t, std::list<std::string> > groupOrderedBySize;
+  
+  TMap summaries;
+  
+  GetDataSetSummaries(dslist,summaries);
+  
+  TIter next(&dslist);
+  TObjString* str;
+  
+  while ( (str = static_cast<TObjString*>(next())) )
+  {
+    TString sname(str->String());
+    sname = sname.Strip();
+    
+    std::string id = DataSetGroup(sname);
+    
+    groups[id].push_back(sname.Data());
+    
+    TFileCollection* fc = static_cast<TFileCollection*>(summaries.GetValue(sname.Data()));
+    
+    groupSize[id] += fc ? fc->GetTotalSize() : 0;
+  }
+  
+  std::map<std::string,std::list<std::string> >::const_iterator it;
+  
+  for ( it = groups.begin(); it != groups.end(); ++it )
+  {
+    
+    groupOrderedBySize[groupSize[it->first]].push_back(it->first);
+    
+    const std::list<std::string>& li = it->second;
+    std::list<std::string>::const_iterator lit;
+    
+    std::cout << it->first;
+    
+    std::cout << Form(" NDATASETS = %3lu SIZE = %6.3f GB ",li.size(),groupSize[it->first]*1.0/byte2GB) << std::endl;
+    
+    for ( lit = li.begin(); lit != li.end(); ++lit )
+    {
+    	std::cout << "   " << (*lit) << std::endl;
+    }
+  }
+  
+  std::cout << "-----------------------------------------" << std::endl;
+  
+  std::map<Long64_t,std::list<std::string> >::const_iterator sit;
+  
+  for ( sit = groupOrderedBySize.begin(); sit != groupOrderedBySize.end(); ++sit )
+  {
+    std::cout << Form("SIZE = %8.3f GB - ",sit->first*1.0/byte2GB);
+    
+    const std::list<std::string>& li = sit->second;
+    if ( li.size() == 1 )
+    {
+      const std::list<std::string>& lst = groups[li.front()];
+      
+      std::cout << li.front() << " (contains " << lst.size() << " datasets) - ";
+    }
+    else
+    {
+      std::cout << "   " << li.size() << " datasets : ";
+      std::list<std::string>::const_iterator lit;
+      
+      for ( lit = li.begin(); lit != li.end(); ++lit )
+      {
+        std::cout << " [ " << (*lit) << " ] ";
+      }
+    }
+    std::cout << std::endl << std::endl;
+  }
+  
+}
+
+//______________________________________________________________________________
+void VAF::GroupDatasets(const char* dslist)
+{
+  /// given a filename containing a list of dataset names
+  /// try to group them (criteria being ignoring the run numbers to group)
+  ///
+  ifstream in(dslist);
+  char name[1024];
+  
+  TList list;
+  list.SetOwner(kTRUE);
+  
+  while (in.getline(name,1024,'\n'))
+  {
+    TString sname(name);
+    sname = sname.Strip();
+    
+    list.Add(new TObjString(sname));
+  }
+  
+  GroupDatasets(list);
+}
+
+//______________________________________________________________________________
+void VAF::InvalidateCache(const char* dsname)
+{
+  /// Remove one dataset from the local cache, or all of them if dsname is empty
+  
+  if ( fCacheDir.Length() == 0 ) return;
+  
+  if ( strlen(dsname) > 0 )
+  {
+    gSystem->Unlink(CacheFileName(dsname).Data());
+    return;
+  }
+  
+  void* dirp = gSystem->OpenDirectory(fCacheDir.Data());
+  
+  if (!dirp) return;
+  
+  const char* name;
+  std::vector<std::string> files;
+  
+  while ( ( name = gSystem->GetDirEntry(dirp) ) )
+  {
+    if ( TString(name).EndsWith(".root") )
+    {
+      files.push_back(Form("%s/%s",fCacheDir.Data(),name));
+    }
+  }
+  
+  gSystem->FreeDirectory(dirp);
+  
+  for ( std::vector<std::string>::size_type i = 0; i < files.size(); ++i )
+  {
+    gSystem->Unlink(files[i].c_str());
+  }
+  
+  std::cout << files.size() << " dataset(s) removed from the cache " << fCacheDir.Data() << std::endl;
+}
+
+//______________________________________________________________________________
+void VAF::MergeDataSets(const char* dsList)
+{
+  /// Merge all the datasets listed in dsList, up to Parallelism() of them at the same time.
+  /// Merges are started largest first, as long as there are no more than
+  /// fMaxReadsPerServer merges reading from any of their servers and no more than
+  /// fMaxWrites merges writing their output (see SetMergeLimits).
+  /// If MergeOnServers(), the datasets are instead merged one after the other
+  /// (see MergeFileCollectionOnServers), as this goes through the PROOF connection,
+  /// and is already spread over all the servers.
+  
+  if ( !Connect() ) return;
+  
+  ifstream in(gSystem->ExpandPathName(dsList));
+	char line[1024];
+  
+  std::vector<MergeJob> jobs;
+  
+  // the dataset queries go through the PROOF connection, so are done here, one by one
+	while ( in.getline(line,1024,'\n') )
+	{
+    std::unique_ptr<TFileCollection> fc(GetDataSet(line));
+    
+    if (!fc)
+    {
+      cout << "Could not get dataset " << line << endl;
+      continue;
+    }
+    
+    MergeJob job;
+    
+    job.fName = line;
+    
+    TString output(line);
+    output.ReplaceAll("/","_");
+    output += ".merged";
+    job.fOutput = output.Data();
+    
+    TIter next(fc->GetList());
+    TFileInfo* fi;
+    while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+    {
+      TUrl url(*(fi->GetFirstUrl()));
+      
+      job.fInputs.push_back(url.GetUrl());
+      job.fHosts.insert(url.GetHost());
+      job.fSize += fi->GetSize();
+    }
+    
+    jobs.push_back(job);
+  }
+  
+  std::sort(jobs.begin(),jobs.end(),LargerJob);
+  
+  for ( std::vector<MergeJob>::size_type i = 0; i < jobs.size(); ++i )
+  {
+    cout << Form("%7.2f GB %5lu files from %3lu servers %s -> %s",jobs[i].fSize/byte2GB,jobs[i].fInputs.size(),
+                 jobs[i].fHosts.size(),jobs[i].fName.c_str(),jobs[i].fOutput.c_str()) << endl;
+  }
+  
+  if (DryRun())
+  {
+    cout << "DRY RUN ONLY. NO MERGING DONE" << endl;
+    return;
+  }
+  
+  if (MergeOnServers())
+  {
+    for ( std::vector<MergeJob>::size_type i = 0; i < jobs.size(); ++i )
+    {
+      std::unique_ptr<TFileCollection> fc(GetDataSet(jobs[i].fName.c_str()));
+      
+      cout << "Starting to merge " << jobs[i].fName << " on the data servers" << endl;
+      
+      Bool_t ok = fc && MergeFileCollectionOnServers(*fc,jobs[i].fOutput.c_str());
+      
+      cout << ( ok ? "Merged " : "Merging failed for " ) << jobs[i].fName << endl;
+    }
+    return;
+  }
+  
+  std::mutex mutex;
+  std::condition_variable done;
+  std::vector<bool> started(jobs.size(),false);
+  std::map<std::string,int> reads;
+  Int_t writes(0);
+  std::vector<MergeJob>::size_type nstarted(0);
+  Int_t nthreads = TMath::Max(Parallelism(),1);
+  
+  AFParallel::EnableThreadSafety();
+  
+  // each thread takes the largest job whose servers and output disk are not saturated
+  AFParallel::ForEach(nthreads,nthreads,[&](std::size_t)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    
+    while ( nstarted < jobs.size() )
+    {
+      std::vector<MergeJob>::size_type j(jobs.size());
+      
+      for ( std::vector<MergeJob>::size_type i = 0; i < jobs.size() && j == jobs.size(); ++i )
+      {
+        if ( started[i] ) continue;
+        
+        Bool_t ok = ( writes < fMaxWrites );
+        
+        for ( std::set<std::string>::const_iterator h = jobs[i].fHosts.begin(); h != jobs[i].fHosts.end() && ok; ++h )
+        {
+          ok = ( reads[*h] < fMaxReadsPerServer );
+        }
+        
+        // when nothing is running, the limits cannot be the reason not to start
+        if ( ok || writes == 0 ) j = i;
+      }
+      
+      if ( j == jobs.size() )
+      {
+        done.wait(lock);
+        continue;
+      }
+      
+      started[j] = true;
+      ++nstarted;
+      ++writes;
+      for ( std::set<std::string>::const_iterator h = jobs[j].fHosts.begin(); h != jobs[j].fHosts.end(); ++h )
+      {
+        ++reads[*h];
+      }
+      
+      cout << "Starting to merge " << jobs[j].fName << endl;
+      
+      lock.unlock();
+      
+      // one merge at a time per job, for the limits above to hold
+      Bool_t ok = MergeFileList(jobs[j].fInputs,jobs[j].fOutput.c_str(),1);
+      
+      lock.lock();
+      
+      cout << ( ok ? "Merged " : "Merging failed for " ) << jobs[j].fName << endl;
+      
+      --writes;
+      for ( std::set<std::string>::const_iterator h = jobs[j].fHosts.begin(); h != jobs[j].fHosts.end(); ++h )
+      {
+        --reads[*h];
+      }
+      
+      done.notify_all();
+    }
+  });
+}
+
+//______________________________________________________________________________
+void VAF::MergeOneDataSet(const char* dsname)
+{
+  std::unique_ptr<TFileCollection> fc(GetDataSet(dsname));
+  
+  if (!fc)
+  {
+    cout << "Could not get dataset " << dsname << endl;
+    return;
+  }
+  
+  TString output(dsname);
+  
+  output.ReplaceAll("/","_");
+  output += ".merged";
+  
+  std::vector<std::string> inputs;
+  
+  TIter next(fc->GetList());
+  TFileInfo* fi;
+  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  {
+    TUrl url(*(fi->GetFirstUrl()));
+    
+    cout << "Adding " << url.GetUrl() << endl;
+    inputs.push_back(url.GetUrl());
+  }
+  
+  cout << "output=" << output.Data() << endl;
+  
+  if (!DryRun() && MergeOnServers())
+  {
+    cout << "starting to merge on the data servers" << endl;
+    if (!MergeFileCollectionOnServers(*fc,output.Data()))
+    {
+      cout << "Merging of " << dsname << " failed" << endl;
+    }
+  }
+  else if (!DryRun())
+  {
+    cout << "starting to merge" << endl;
+    if (!MergeFileList(inputs,output.Data()))
+    {
+      cout << "Merging of " << dsname << " failed" << endl;
+    }
+  }
+  else
+  {
+    cout << "DRY RUN ONLY. NO MERGING DONE" << endl;
+  }
+}
+
+//______________________________________________________________________________
+Bool_t VAF::MergeFileCollectionOnServers(TFileCollection& fc, const char* output)
+{
+  /// Merge the files of fc into output, in two stages : first each data server
+  /// merges (with hadd, run from the PROOF workers) the files it holds into
+  /// partial merges, then only those partial merges are read back to be merged
+  /// (by MergeFileList) into output.
+  /// The commands sent to the workers are built so that each worker only
+  /// acts on the files of its own host, and all hosts work at the same time.
+  /// They are sent in as many rounds as needed to keep them short enough,
+  /// each round giving one partial merge per host.
+  /// The files of hosts without a PROOF worker are merged from here instead,
+  /// together with the partial merges, but it is an error if no file at all is on
+  /// a host with a worker.
+  
+  // the dataset queries done before have opened a session without workers
+  CloseConnection();
+  
+  if (!Connect("workers=1x")) return kFALSE;
+  
+  TUrl u(gProof->GetDataPoolUrl());
+  TString pool(u.GetFile());
+  
+  // output comes from the dataset name, which can contain anything (e.g. ; or =)
+  TMD5 md5;
+  
+  md5.Update((const UChar_t*)output,(UInt_t)strlen(output));
+  md5.Final();
+  
+  TString tmpDir(Form("/tmp/merge/%s",md5.AsString()));
+  
+  std::vector<std::string> workers;
+  TIter nextWorker(gProof->GetListOfSlaveInfos());
+  TSlaveInfo* slave;
+  
+  while ( ( slave = static_cast<TSlaveInfo*>(nextWorker()) ) )
+  {
+    workers.push_back(slave->fHostName.Data());
+  }
+  
+  // local paths of the files of each host
+  std::map<std::string,std::vector<std::string> > files;
+  std::map<std::string,Bool_t> poolInUrl;
+  std::vector<std::string> clientFiles;
+  
+  TIter next(fc.GetList());
+  TFileInfo* fi;
+  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  {
+    TUrl url(*(fi->GetFirstUrl()));
+    TString file(url.GetFile());
+    Bool_t hasWorker(kFALSE);
+    
+    for ( std::vector<std::string>::size_type w = 0; w < workers.size() && !hasWorker; ++w )
+    {
+      hasWorker = SameHost(url.GetHost(),workers[w]);
+    }
+    
+    if (!hasWorker)
+    {
+      clientFiles.push_back(url.GetUrl());
+      continue;
+    }
+    
+    poolInUrl[url.GetHost()] = file.BeginsWith(pool);
+    
+    if (!file.BeginsWith(pool)) file.Prepend(pool);
+    
+    files[url.GetHost()].push_back(file.Data());
+  }
+  
+  if ( files.empty() )
+  {
+    std::cout << "None of the " << clientFiles.size() << " files is on a host with a PROOF worker ("
+    << workers.size() << " workers) : not merging" << std::endl;
+    return kFALSE;
+  }
+  
+  if ( !clientFiles.empty() )
+  {
+    std::cout << clientFiles.size() << " files are on hosts without PROOF worker, and will be merged from here" << std::endl;
+  }
+  
+  std::map<std::string,std::vector<std::string>::size_type> done;
+  std::vector<std::string> partials;
+  std::vector<std::string> cleanup;
+  Int_t round(0);
+  Bool_t more(kTRUE);
+  
+  while (more)
+  {
+    more = kFALSE;
+    
+    TString cmd(".!");
+    std::string::size_type share = kMaxShellCommand / files.size();
+    
+    for ( std::map<std::string,std::vector<std::string> >::const_iterator it = files.begin(); it != files.end(); ++it )
+    {
+      const std::string& host = it->first;
+      const std::vector<std::string>& hfiles = it->second;
+      std::vector<std::string>::size_type& i = done[host];
+      
+      if ( i >= hfiles.size() ) continue;
+      
+      TString partial(Form("%s%s/%s.%d.root",pool.Data(),tmpDir.Data(),host.c_str(),round));
+      TString hadd(Form(" hadd -f %s",ShellQuote(partial.Data()).c_str()));
+      
+      // at least one file per round, whatever its length
+      do
+      {
+        hadd += " ";
+        hadd += ShellQuote(hfiles[i]).c_str();
+        ++i;
+      } while ( i < hfiles.size() && hadd.Length() + hfiles[i].size() + 3 < share );
+      
+      // hosts are matched on their short name, as SameHost does
+      cmd += Form(" case \"$(hostname -s)\" in %s) mkdir -p %s && %s ;; esac ;",
+                  ShellQuote(ShortHost(host)).c_str(),ShellQuote(Form("%s%s",pool.Data(),tmpDir.Data())).c_str(),hadd.Data());
+      
+      partials.push_back(Form("root://%s/%s",host.c_str(),
+                              poolInUrl[host] ? partial.Data() : partial.Data()+pool.Length()));
+      
+      if ( i < hfiles.size() ) more = kTRUE;
+    }
+    
+    std::cout << "Merge round " << round << " on the data servers" << std::endl;
+    
+    gProof->Exec(cmd.Data(),"*",kTRUE);
+    
+    ++round;
+  }
+  
+  // check all partial merges are there before going on
+  Bool_t ok(kTRUE);
+  
+  for ( std::vector<std::string>::size_type i = 0; i < partials.size(); ++i )
+  {
+    FileStat_t st;
+    
+    if ( gSystem->GetPathInfo(partials[i].c_str(),st) )
+    {
+      std::cout << "Partial merge " << partials[i] << " is missing" << std::endl;
+      ok = kFALSE;
+    }
+  }
+  
+  if (ok)
+  {
+    std::cout << "Merging " << partials.size() << " partial merges and " << clientFiles.size()
+    << " files into " << output << std::endl;
+    partials.insert(partials.end(),clientFiles.begin(),clientFiles.end());
+    ok = MergeFileList(partials,output);
+  }
+  
+  TString rm(".!");
+  
+  for ( std::map<std::string,std::vector<std::string> >::const_iterator it = files.begin(); it != files.end(); ++it )
+  {
+    rm += Form(" case \"$(hostname -s)\" in %s) rm -rf %s ;; esac ;",
+               ShellQuote(ShortHost(it->first)).c_str(),ShellQuote(Form("%s%s",pool.Data(),tmpDir.Data())).c_str());
+  }
+  
+  gProof->Exec(rm.Data(),"*",kTRUE);
+  
+  return ok;
+}
+
+//______________________________________________________________________________
+Bool_t VAF::MergeFileList(const std::vector<std::string>& inputs, const char* output, Int_t nthreads) const
+{
+  /// Merge the inputs into output.
+  /// If MergeFanIn() > 1 the merging is done as a tree reduction : consecutive
+  /// groups of at most MergeFanIn() files are merged concurrently (nthreads, or
+  /// Parallelism() if negative, of them at a time) into intermediate files, which are in turn merged the same
+  /// way until only one merge is left. As groups are kept in the input order, the
+  /// final output has the same content, in the same order, as a one go merge.
+  /// Intermediate files are removed as soon as they have been merged.
+  
+  std::vector<std::string> level(inputs);
+  std::vector<std::string> intermediates;
+  Bool_t ok(kTRUE);
+  Int_t stage(0);
+  
+  while ( ok && MergeFanIn() > 1 && level.size() > static_cast<std::size_t>(MergeFanIn()) )
+  {
+    std::size_t ngroups = ( level.size() + MergeFanIn() - 1 ) / MergeFanIn();
+    std::vector<std::string> merged(ngroups);
+    std::vector<int> status(ngroups,0);
+    
+    cout << Form("Merge stage %d : %lu files into %lu intermediate files",stage,level.size(),ngroups) << endl;
+    
+    AFParallel::ForEach(ngroups,nthreads < 0 ? Parallelism() : nthreads,[&](std::size_t g)
+    {
+      // spread the files evenly over the groups
+      std::vector<std::string> group(level.begin() + g*level.size()/ngroups,
+                                     level.begin() + (g+1)*level.size()/ngroups);
+      
+      merged[g] = TString::Format("%s.stage%d.%lu.root",output,stage,g).Data();
+      
+      // only the first stage reads remote files
+      status[g] = MergeFiles(group,merged[g].c_str(),stage==0) ? 1 : 0;
+    });
+    
+    for ( std::size_t g = 0; g < ngroups; ++g )
+    {
+      if (!status[g])
+      {
+        cout << "Could not merge into " << merged[g] << endl;
+        ok = kFALSE;
+      }
+    }
+    
+    for ( std::vector<std::string>::size_type i = 0; i < intermediates.size(); ++i )
+    {
+      gSystem->Unlink(intermediates[i].c_str());
+    }
+    
+    intermediates = merged;
+    level = merged;
+    ++stage;
+  }
+  
+  if (ok)
+  {
+    ok = MergeFiles(level,output,stage==0);
+  }
+  
+  for ( std::vector<std::string>::size_type i = 0; i < intermediates.size(); ++i )
+  {
+    gSystem->Unlink(intermediates[i].c_str());
+  }
+  
+  return ok;
+}
+
+//______________________________________________________________________________
+void VAF::GetFreeSpacePerServer(std::map<std::string,Long64_t>& freeSpace, std::map<std::string,Long64_t>* capacity)
+{
+  /// Get the free space (in bytes) of the data pool partition of each server
+  /// (and its size, if capacity is given)
+  
+  freeSpace.clear();
+  if (capacity) capacity->clear();
+  
+  // a session opened before (e.g. for dataset queries) might have no workers
+  CloseConnection();
+  
+  if (!Connect("workers=1x")) return;
+  
+  std::set<std::string> hosts;
+  TIter nextWorker(gProof->GetListOfSlaveInfos());
+  TSlaveInfo* slave;
+  
+  while ( ( slave = static_cast<TSlaveInfo*>(nextWorker()) ) )
+  {
+    hosts.insert(ShortHost(slave->fHostName.Data()));
+  }
+  
+  TUrl u(gProof->GetDataPoolUrl());
+  
+  TString s = GetStringFromExec(Form(".! echo $(hostname -f) $(df -P -B1 %s | tail -1 | awk '{print $4, $2}')",u.GetFile()));
+  
+  TObjArray* a = s.Tokenize("\n");
+  TObjString* os;
+  TIter next(a);
+  
+  while ( ( os = static_cast<TObjString*>(next()) ) )
+  {
+    std::istringstream in(os->String().Data());
+    std::string host;
+    Long64_t bytes;
+    Long64_t size;
+    
+    if ( in >> host >> bytes >> size )
+    {
+      freeSpace[host] = bytes;
+      if (capacity) (*capacity)[host] = size;
+    }
+  }
+  
+  delete a;
+  
+  if ( freeSpace.size() != hosts.size() )
+  {
+    std::cout << "WARNING : got the free space of " << freeSpace.size() << " servers, but there are "
+    << hosts.size() << " worker hosts" << std::endl;
+  }
+}
+
+//______________________________________________________________________________
+void VAF::PlanStaging(const char* dsList, Double_t reserve)
+{
+  /// Tell whether (and where) the staging of the datasets in dsList would fit
+  /// in the free space of the servers, keeping a reserve fraction of each of them free.
+  ///
+  /// The bytes still to be staged are the sizes of the files not staged yet, as known
+  /// by the catalogue. Files of unknown size are counted with the mean size of the
+  /// staged files. The files are then placed one by one, in the list order, on the
+  /// server with the most free space left, which is what the stager tends to do.
+  
+  std::ifstream in(gSystem->ExpandPathName(dsList));
+  std::string line;
+  std::set<std::string> seen;
+  
+  TList list;
+  list.SetOwner(kTRUE);
+  
+  while (std::getline(in,line))
+  {
+    TString dsname(line.c_str());
+    dsname = dsname.Strip(TString::kBoth);
+    
+    if ( dsname.Length() == 0 || !seen.insert(dsname.Data()).second ) continue;
+    
+    list.Add(new TObjString(dsname));
+  }
+  
+  TMap summaries;
+  
+  GetDataSetSummaries(list,summaries);
+  
+  // sizes of the files still to be staged (-1 if unknown), per dataset
+  std::map<std::string,std::vector<Long64_t> > toStage;
+  
+  // mean size of the files staged so far, used for the files of unknown size
+  Long64_t stagedSize(0);
+  Long64_t nstaged(0);
+  
+  TIter next(&list);
+  TObjString* str;
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
+  {
+    TFileCollection* summary = static_cast<TFileCollection*>(summaries.GetValue(str->String().Data()));
+    
+    // the file list is only needed for datasets not fully staged
+    if ( !summary || summary->GetNStagedFiles() >= summary->GetNFiles() ) continue;
+    
+    std::unique_ptr<TFileCollection> fc(GetDataSet(str->String().Data()));
+    
+    if (!fc) continue;
+    
+    std::vector<Long64_t>& sizes = toStage[str->String().Data()];
+    TIter nextFile(fc->GetList());
+    TFileInfo* fi;
+    
+    while ( ( fi = static_cast<TFileInfo*>(nextFile()) ) )
+    {
+      if ( fi->TestBit(TFileInfo::kStaged) )
+      {
+        if ( fi->GetSize() > 0 )
+        {
+          stagedSize += fi->GetSize();
+          ++nstaged;
+        }
+      }
+      else
+      {
+        sizes.push_back(fi->GetSize() > 0 ? fi->GetSize() : -1);
+      }
+    }
+  }
+  
+  Long64_t defaultFileSize = ( nstaged > 0 ) ? stagedSize/nstaged : 0;
+  
+  std::map<std::string,Long64_t> freeSpace;
+  std::map<std::string,Long64_t> capacity;
+  
+  GetFreeSpacePerServer(freeSpace,&capacity);
+  
+  if ( freeSpace.empty() )
+  {
+    std::cout << "Could not get the free space of the servers" << std::endl;
+    return;
+  }
+  
+  // usable space (i.e. above the reserve) left on each server
+  std::map<std::string,Long64_t> left;
+  Long64_t totalFree(0);
+  
+  for ( std::map<std::string,Long64_t>::const_iterator it = freeSpace.begin(); it != freeSpace.end(); ++it )
+  {
+    left[it->first] = TMath::Max(it->second - static_cast<Long64_t>(capacity[it->first]*reserve),0LL);
+    totalFree += left[it->first];
+  }
+  
+  std::map<std::string,Long64_t> volume;
+  std::map<std::string,Long64_t> nfiles;
+  Long64_t totalToStage(0);
+  Bool_t fits(kTRUE);
+  
+  next.Reset();
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
+  {
+    TFileCollection* fc = static_cast<TFileCollection*>(summaries.GetValue(str->String().Data()));
+    
+    if (!fc)
+    {
+      std::cout << str->String().Data() << " does not exist (query return nothing)" << std::endl;
+      continue;
+    }
+    
+    const std::vector<Long64_t>& sizes = toStage[str->String().Data()];
+    Long64_t bytes(0);
+    Long64_t nestimated(0);
+    
+    for ( std::vector<Long64_t>::size_type i = 0; i < sizes.size(); ++i )
+    {
+      Long64_t fileSize = sizes[i];
+      
+      if ( fileSize < 0 )
+      {
+        fileSize = defaultFileSize;
+        ++nestimated;
+      }
+      
+      std::map<std::string,Long64_t>::iterator best = left.begin();
+      
+      for ( std::map<std::string,Long64_t>::iterator it = left.begin(); it != left.end(); ++it )
+      {
+        if ( it->second > best->second ) best = it;
+      }
+      
+      if ( best->second < fileSize && fits )
+      {
+        std::cout << "*** The request does not fit anymore from dataset " << str->String().Data() << " on" << std::endl;
+        fits = kFALSE;
+      }
+      
+      best->second -= fileSize;
+      volume[best->first] += fileSize;
+      ++nfiles[best->first];
+      bytes += fileSize;
+    }
+    
+    totalToStage += bytes;
+    
+    std::cout << Form("%s nfiles %5lld to stage %5lu : %7.2f GB",str->String().Data(),
+                      fc->GetNFiles(),sizes.size(),bytes/byte2GB);
+    if ( nestimated ) std::cout << Form(" (%lld files of unknown size estimated from the staged ones)",nestimated);
+    std::cout << std::endl;
+  }
+  
+  std::cout << std::string(80,'_') << std::endl;
+  
+  for ( std::map<std::string,Long64_t>::const_iterator it = freeSpace.begin(); it != freeSpace.end(); ++it )
+  {
+    std::cout << Form("%-40s free %8.2f GB transfer %5lld files %8.2f GB free after %8.2f GB",it->first.c_str(),
+                      it->second/byte2GB,nfiles[it->first],volume[it->first]/byte2GB,
+                      (it->second-volume[it->first])/byte2GB) << std::endl;
+  }
+  
+  std::cout << std::string(80,'_') << std::endl;
+  std::cout << Form("To stage %7.2f GB, usable free space %7.2f GB (keeping %4.1f %% of each server free) : %s",
+                    totalToStage/byte2GB,totalFree/byte2GB,reserve*100,
+                    fits ? "the request fits" : "the request DOES NOT fit") << std::endl;
+}
+
+//______________________________________________________________________________
+void VAF::Print(Option_t* /*opt*/) const
+{
+  std::cout << ClassName()
+  << " talking to " << fMaster.Data() << std::endl
+  << " LogDir         :  " << fLogDir.Data() << std::endl
+  << " HomeDir        :  " << fHomeDir.Data() << std::endl
+  << " FileType       :  " << FileTypeToLookFor() << std::endl
+  << " DynamicDataSet : " << fIsDynamicDataSet << std::endl
+  << " CacheDir       :  " << fCacheDir.Data() << " (TTL " << fCacheTTL << " s)" << std::endl
+  << " Parallelism    :  " << fParallelism << std::endl
+  << " JournalDir     :  " << fJournalDir.Data() << std::endl
+  << " MergeFanIn     :  " << fMergeFanIn << std::endl
+  << " MergeOnServers :  " << fMergeOnServers << std::endl
+  << " MergeLimits    :  " << fMaxReadsPerServer << " reads per server, " << fMaxWrites << " writes" << std::endl
+  << " CheckLevel     :  " << ( fCheckLevel == kFastCheck ? "fast" : "full" ) << std::endl;
+  
+  if ( IsSampling() )
+  {
+    std::cout << " Sampling       :  " << Form("%g of the files, %g of the entries (seed %u), full check after %d failures in one run or server",
+                                             fSampleFileFraction,fSampleEntryFraction,fSampleSeed,fSampleEscalation) << std::endl;
+  }
+  
+  if ( fDryRun )
+  {
+    std::cout << "Currently in dry run mode " << std::endl;
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ReadIntegers(const char* filename, std::vector<int>& integers)
+{
+  /// Read integers from filename, where integers are either
+  /// separated by "," or by return carriage
+  ifstream in(gSystem->ExpandPathName(filename));
+  int i;
+  
+  std::set<int> runset;
+  
+  char line[10000];
+  
+  in.getline(line,10000,'\n');
+  
+  TString sline(line);
+  
+  if (sline.Contains(","))
+  {
+    TObjArray* a = sline.Tokenize(",");
+    TIter next(a);
+    TObjString* s;
+    while ( ( s = static_cast<TObjString*>(next()) ) )
+    {
+      runset.insert(s->String().Atoi());
+    }
+    delete a;
+  }
+  else
+  {
+    runset.insert(sline.Atoi());
+    
+    while ( in >> i )
+    {
+      runset.insert(i);
+    }
+  }
+  
+  for ( std::set<int>::const_iterator it = runset.begin(); it != runset.end(); ++it )
+  {
+    integers.push_back((*it));
+  }
+  
+  std::sort(integers.begin(),integers.end());
+}
+
+//______________________________________________________________________________
+int VAF::ReadBaskets(const char* treename, Double_t entryFraction, UInt_t seed)
+{
+  /// Fast verification of a tree : read and decompress every basket of
+  /// every branch, without building the event objects.
+  /// If entryFraction < 1 only the baskets holding the entries sampled
+  /// (see ReadTree) are read.
+  /// Return the number of entries of the tree, or -2 in case of problem (like ReadTree)
+  
+  TTree* tree = static_cast<TTree*>(gDirectory->Get(treename));
+  if (!tree) return -2;
+  
+  EntryRanges ranges = SampleEntryRanges(tree->GetEntries(),entryFraction,seed);
+  
+  std::vector<TBranch*> branches;
+  
+  GetAllBranches(tree->GetListOfBranches(),branches);
+  
+  if ( tree->BranchRef() ) branches.push_back(tree->BranchRef());
+  
+  for ( std::vector<TBranch*>::size_type i = 0; i < branches.size(); ++i )
+  {
+    if (!CheckBaskets(*branches[i],ranges)) return -2;
+  }
+  
+  return tree->GetEntries();
+}
+
+//______________________________________________________________________________
+void VAF::RemoveDataFromOneDataSet(const char* dsName, std::ofstream& out)
+{
+  std::unique_ptr<TFileCollection> fc(GetDataSet(dsName));
+  
+  if (!fc) return;
+  
+  TIter next(fc->GetList());
+  TFileInfo* fi;
+  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  {
+    TUrl url(*(fi->GetFirstUrl()));
+    
+    if  (TString(url.GetHost()).Contains(fMaster.Data())) continue; // means not staged, so nothing to remove...
+    
+    out << Form("echo \"xrd %s rm %s\"",url.GetHost(),url.GetFile()) << std::endl;
+    
+    out << "xrd " << url.GetHost() << " rm " << url.GetFile() << std::endl;
+  }
+  
+}
+
+//______________________________________________________________________________
+void VAF::RemoveDataFromOneDataSet(const char* dsName)
+{
+  if ( fConnect.Length()==0 ) return;
+  TProof::Open(fConnect.Data(),"masteronly");
+  if (!gProof) return;
+  
+
+  std::ofstream out("delete-one-dataset.sh");
+  
+  RemoveDataFromOneDataSet(dsName,out);
+  
+  out.close();
+}
+
+//______________________________________________________________________________
+void VAF::RemoveDataFromDataSetFromFile(const char* dslist)
+{
+  if ( fConnect.Length()==0 ) return;
+  TProof::Open(fConnect.Data(),"masteronly");
+  if (!gProof) return;
+
+  std::ofstream out("delete-multiple-dataset.sh");
+  
+  ifstream in(gSystem->ExpandPathName(dslist));
+  char line[1024];
+  
+  while ( in.getline(line,1024,'\n') )
+  {
+    std::cout << "Preparing cmd line for dataset " << line << std::endl;
+    RemoveDataFromOneDataSet(line,out);
+  }
+  
+  out.close();
+}
+
+//______________________________________________________________________________
+void VAF::RemoveDataSets(const char* dslist)
+{
+  if ( fConnect.Length()==0 ) return;
+  TProof::Open(fConnect.Data(),"masteronly");
+  if (!gProof) return;
+
+  ifstream in(gSystem->ExpandPathName(dslist));
+  char line[1024];
+  
+  while ( in.getline(line,1024,'\n') )
+  {
+    std::cout << "Removing data set " << line << std::endl;
+    gProof->RemoveDataSet(line);
+  }
+}
+
+//______________________________________________________________________________
+void VAF::Reset(const char* option)
+{
+  UpdateConnectString();
+  
+  TString soption(option);
+  soption.ToUpper();
+  Bool_t hard(kFALSE);
+  if ( soption.Contains("HARD") )
+  {
+    hard = kTRUE;
+  }
+  
+  TProof::Mgr(fConnect.Data())->Reset(hard);
+}
+
+//______________________________________________________________________________
+void VAF::ResetRoot()
+{
+  TProof::Mgr(fConnect.Data())->SetROOTVersion("current");
+}
+
+//______________________________________________________________________________
+void VAF::ShowDataSetContent(const char* dssetfile)
+{
+  /// Show the content of one or several datasets
+  
+  TList list;
+  list.SetOwner(kTRUE);
+  
+  if ( gSystem->AccessPathName(dssetfile) )
+  {
+    // single dataset (i.e. not a text file containing a list of dataset...)
     
-    TString test(sname.Data());
+    std::cout << "INFO: " << dssetfile << " is not a file name, assuming it's a dataset" << std::endl;
+    list.Add(new TObjString(dssetfile));
+  }
+  else
+  {
+    ifstream in(gSystem->ExpandPathName(dssetfile));
+    char line[1024];
     
-    Int_t ix = test.Index("_000");
+    while ( ( in.getline(line,1023,'\n') ) )
+    {
+      list.Add(new TObjString(line));
+    }
+  }
+  
+  ShowDataSetContent(list);
+}
+
+//______________________________________________________________________________
+void VAF::ShowDataSetContent(const TList& list)
+{
+  TIter next(&list);
+  TObjString* str;
+  
+  while ( ( str = static_cast<TObjString*>(next())) )
+  {
+    std::unique_ptr<TFileCollection> fc(GetDataSet(str->String().Data()));
+    if (!fc) continue;
     
-    TString id(sname.Data());
+    TIter nextFileInfo(fc->GetList());
+    TFileInfo* fi;
+    while ( ( fi = static_cast<TFileInfo*>(nextFileInfo()) ) )
+    {
+      TUrl url(*(fi->GetFirstUrl()));
+      
+      cout << url.GetUrl() << endl;
+    }
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowDataSetList(const char* path)
+{
+  TList datasets;
+  GetDataSetList(datasets); // ,path);
+
+  TIter next(&datasets);
+  TObjString* dsName;
+
+  while ((dsName = static_cast<TObjString*>(next())))
+  {
+    if ( dsName->String().Contains(path) )
+    {
+      std::cout << dsName->String().Data() << std::endl;
+    }
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowDataSets(const char* runlist)
+{
+  // Show all datasets for the runs in run list
+  std::vector<int> runs;
+  ReadIntegers(runlist,runs);
+  if (runs.empty()) return;
+  
+  if ( Connect() )
+  {
+    for ( std::vector<int>::size_type i = 0; i < runs.size(); ++i )
+    {
+      ShowDataSetList(Form("*%d*",runs[i]));
+    }
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowDiskUsage()
+{
+  if (Connect("workers=1x"))
+  {
+    TUrl u(gProof->GetDataPoolUrl());
     
-    if ( ix >= 0 )
+    gProof->Exec(Form(".!hostname ; df -h %s",u.GetFile()));
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowPackages()
+{
+  if (Connect("masteronly"))
+  {
+    gProof->ShowPackages();
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowStagerLog()
+{
+  /// Dump on screen the log of the stager daemon
+  if (Connect("masteronly"))
+  {
+    gProof->Exec(Form(".!cat %s/afdsmgrd/afdsmgrd.log",LogDir().Data()),"0");
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowXferLog(const char* file)
+{
+  if (Connect("workers=1x"))
+  {
+//    gProof->Exec(Form(".!hostname ; cat %s/xrootd/xrddm/%s/xrddm_*.log",LogDir().Data(),file));
+    gProof->Exec(Form(".!hostname ; cat %s/xrootd/data/%s.anew/saf-stage.log",LogDir().Data(),file));
+  }
+}
+
+//______________________________________________________________________________
+void VAF::ShowXrdDmLog()
+{
+  if (Connect("workers=1x"))
+  {
+    gProof->Exec(Form(".!echo '**************************************'; hostname -a ; cat %s/xrootd/xrddm.log",LogDir().Data()));
+    gProof->Exec(".!echo '++++++++++++++++++++++++++++++++++++++'; hostname -a ; cat /var/log/xrootd/xrddm.log");
+//    gProof->Exec(".!echo '++++++++++++++++++++++++++++++++++++++'; hostname -a ; tail -100 /var/log/xrootd/saf_stage.log");
+  }
+  
+}
+
+//______________________________________________________________________________
+void VAF::ShowLog()
+{
+  if (Connect("workers=1x"))
+  {
+    gProof->Exec(".!echo '++++++++++++++++++++++++++++++++++++++'; hostname -a ; tail -100 /var/log/xrootd/saf_stage.log");
+  }
+  
+}
+
+//______________________________________________________________________________
+void VAF::ShowTransfers()
+{
+  /// Show CpMacro* transfers
+  
+  if ( Connect("workers=1x") )
+  {
+    gProof->Exec(".!hostname ; ps -edf | grep CpMacro | grep root.exe | grep -v ps | grep -v sh | wc -l");
+  }
+  
+}
+
+//______________________________________________________________________________
+void VAF::ShowConfig()
+{
+   if (Connect("workers=1x"))
+   {
+     std::vector<std::string> files;
+     
+     files.push_back("%s/proof/xproofd/prf-main.cf");
+     files.push_back("%s/xrootd/etc/xrootd/xrootd.cf");
+     files.push_back("%s/proof/xproofd/afdsmgrd.conf");
+     files.push_back("%s/xrootd/scripts/frm-stage-with-xrddm.sh");
+     files.push_back("%s/xrootd/scripts/frm-stage-with-saf-stage.sh");
+     files.push_back("/usr/local/xrddm/etc/xrddm_env.sh");
+     files.push_back("/usr/local/xrddm/etc/xrddm.cfg");
+     
+     TString cmd(".!");
+     
+     for (std::vector<std::string>::size_type i = 0; i < files.size(); ++i )
+     {
+       TString thefile;
+       
+       thefile.Form(files[i].c_str(),HomeDir().Data());
+       
+       cmd += "echo '************* ";
+       cmd += thefile;
+       cmd += " **********' ; cat ";
+       cmd += thefile;
+       cmd += ";";
+     }
+     
+     gProof->Exec(cmd.Data());
+   }
+}
+
+//______________________________________________________________________________
+int VAF::ReadTree(const char* treename, Double_t entryFraction, UInt_t seed)
+{
+  /// Read the entries of the tree. If entryFraction < 1 only about that
+  /// fraction of the entries is read, as a few ranges of contiguous entries
+  /// drawn at random (with the given seed).
+  /// Return the number of entries of the tree, or -2 in case of problem
+  
+  TTree* tree = static_cast<TTree*>(gDirectory->Get(treename));
+  if (!tree) return -2;
+  
+  Long64_t nentries = tree->GetEntries();
+  
+  EntryRanges ranges = SampleEntryRanges(nentries,entryFraction,seed);
+  
+  for ( EntryRanges::size_type r = 0; r < ranges.size(); ++r )
+  {
+    for (Long64_t i = ranges[r].first; i < ranges[r].second; ++i)
     {
-      TString runNumber = test(ix,10);
-      test.ReplaceAll(runNumber,"");
-      test.ReplaceAll(" ","");
-      id = test;
+      if ( tree->GetEntry(i) <= 0 ) return -2;
     }
+  }
+  
+  return nentries;
+}
+
+//______________________________________________________________________________
+void VAF::TestDataSets(const char* txtfile, Bool_t requestStagingIfNotStaged)
+{
+  /// Check if the datasets in the txtfile are already staged.
+  /// If not, and if requestStagingIfNotStaged is true, will launch a staging request
+  ///
+  /// The (distinct) datasets are looked up all together (see GetDataSetSummaries),
+  /// and those that do not appear fully staged are looked up again all together,
+  /// bypassing the cache, before the staging requests are sent in one go.
+  
+  if (!Connect("masteronly")) return;
+  
+  std::ifstream in(gSystem->ExpandPathName(txtfile));
+  std::string line;
+  
+  std::vector<std::string> msgs;
+  std::vector<std::string> requests;
+  std::set<std::string> seen;
+  
+  Long64_t totalSize(0);
+  
+  TList list;
+  list.SetOwner(kTRUE);
+  
+  // read the text file, skipping duplicated lines
+  while (std::getline(in,line))
+  {
+    TString dsname(line.c_str());
+    dsname = dsname.Strip(TString::kBoth);
     
-    groups[id.Data()].push_back(sname.Data());
+    if ( dsname.Length() == 0 || !seen.insert(dsname.Data()).second ) continue;
     
-    Long64_t size(0);
-    Int_t nfiles,ncorrupted;
-    GetOneDataSetSize(sname.Data(),nfiles,ncorrupted,size,kFALSE);
-    groupSize[id.Data()] += size;
+    list.Add(new TObjString(dsname));
   }
   
-  std::map<std::string,std::list<std::string> >::const_iterator it;
+  TMap summaries;
   
-  for ( it = groups.begin(); it != groups.end(); ++it )
+  GetDataSetSummaries(list,summaries);
+  
+  // if not everything is staged, check first if it's not the caching
+  // mechanism(s) that are giving us an outdated answer
+  TList notStaged;
+  notStaged.SetOwner(kTRUE);
+  
+  TIter next(&list);
+  TObjString* str;
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
   {
+    TFileCollection* fc = static_cast<TFileCollection*>(summaries.GetValue(str->String().Data()));
     
-    groupOrderedBySize[groupSize[it->first]].push_back(it->first);
-    
-    const std::list<std::string>& li = it->second;
-    std::list<std::string>::const_iterator lit;
-    
-    std::cout << it->first;
-    
-    std::cout << Form(" NDATASETS = %3lu SIZE = %6.3f GB ",li.size(),groupSize[it->first]*1.0/byte2GB) << std::endl;
-    
-    for ( lit = li.begin(); lit != li.end(); ++lit )
+    if ( fc && ( fc->GetNStagedFiles() == 0 || fc->GetStagedPercentage() < 100.0 ) )
     {
-    	std::cout << "   " << (*lit) << std::endl;
+      notStaged.Add(new TObjString(str->String()));
     }
   }
   
-  std::cout << "-----------------------------------------" << std::endl;
+  TMap refreshed;
   
-  std::map<Long64_t,std::list<std::string> >::const_iterator sit;
+  if ( notStaged.GetSize() > 0 )
+  {
+    GetDataSetSummaries(notStaged,refreshed,kTRUE);
+  }
   
-  for ( sit = groupOrderedBySize.begin(); sit != groupOrderedBySize.end(); ++sit )
+  next.Reset();
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
   {
-    std::cout << Form("SIZE = %8.3f GB - ",sit->first*1.0/byte2GB);
+    const char* dsname = str->String().Data();
     
-    const std::list<std::string>& li = sit->second;
-    if ( li.size() == 1 )
+    TFileCollection* fc = static_cast<TFileCollection*>(summaries.GetValue(dsname));
+    
+    if (!fc)
     {
-      const std::list<std::string>& lst = groups[li.front()];
-      
-      std::cout << li.front() << " (contains " << lst.size() << " datasets) - ";
+      msgs.push_back(Form("%s does not exist (query return nothing)",dsname));
+      continue;
     }
-    else
+    
+    if ( notStaged.FindObject(dsname) )
     {
-      std::cout << "   " << li.size() << " datasets : ";
-      std::list<std::string>::const_iterator lit;
+      fc = static_cast<TFileCollection*>(refreshed.GetValue(dsname));
       
-      for ( lit = li.begin(); lit != li.end(); ++lit )
+      if (!fc)
       {
-        std::cout << " [ " << (*lit) << " ] ";
+        msgs.push_back(Form("%s does not exist anymore (refreshed query return nothing)",dsname));
+        continue;
+      }
+      
+      if ( fc->GetNStagedFiles() == 0 || fc->GetStagedPercentage() < 100.0 )
+      {
+        // no, that's not the cache's fault, the files are actually not staged.
+        // so they'll need to be requested
+        requests.push_back(dsname);
       }
     }
-    std::cout << std::endl << std::endl;
+    
+    totalSize += fc->GetTotalSize();
+    
+    msgs.push_back(Form("%s staged %4.0f %% nfiles %4lld nstaged %4lld size %6d MB",dsname,fc->GetStagedPercentage(),fc->GetNFiles(),fc->GetNStagedFiles(),TMath::Nint(fc->GetTotalSize()/byte2MB*1.0)));
   }
-  
-}
 
-//______________________________________________________________________________
-void VAF::GroupDatasets(const char* dslist)
-{
-  /// given a filename containing a list of dataset names
-  /// try to group them (criteria being ignoring the run numbers to group)
-  ///
-  ifstream in(dslist);
-  char name[1024];
-  
-  TList list;
-  list.SetOwner(kTRUE);
-  
-  while (in.getline(name,1024,'\n'))
+  // printout
+  std::vector<std::string>::size_type i;
+
+  for ( i = 0 ; i < msgs.size(); ++i )
   {
-    TString sname(name);
-    sname = sname.Strip();
-    
-    list.Add(new TObjString(sname));
+    std::cout << msgs[i] << std::endl;
   }
-  
-  GroupDatasets(list);
-}
 
-//______________________________________________________________________________
-void VAF::MergeDataSets(const char* dsList)
-{
-  if ( !Connect() ) return;
-  
-  ifstream in(gSystem->ExpandPathName(dsList));
-	char line[1024];
+  std::cout << Form("Total size %7.3f GB",totalSize/byte2GB) << std::endl;
   
-	while ( in.getline(line,1024,'\n') )
-	{
-    MergeOneDataSet(line);
+  if (requests.size())
+  {
+    if (!requestStagingIfNotStaged)
+    {
+      std::cout << "The following staging requests would have to be performed" << std::endl;
+    }
+    
+    for ( i = 0 ; i < requests.size(); ++i )
+    {
+      std::cout << requests[i] << std::endl;
+    }
+    
+    if (requestStagingIfNotStaged)
+    {
+      Int_t nok(0);
+      
+      for ( i = 0 ; i < requests.size(); ++i )
+      {
+        if ( gProof->RequestStagingDataSet(requests[i].c_str()) ) ++nok;
+      }
+      
+      std::cout << nok << "/" << requests.size() << " staging requests accepted" << std::endl;
+    }
   }
+
 }
 
 //______________________________________________________________________________
-void VAF::MergeOneDataSet(const char* dsname)
+int VAF::TestROOTFile(const char* file, const char* treename, Bool_t verbose, ECheckLevel level,
+                      Double_t entryFraction, UInt_t seed)
 {
-  if (!Connect()) return;
-  
-  TFileCollection* fc = gProof->GetDataSet(dsname);
-  
-  if (!fc)
-  {
-    cout << "Could not get dataset " << dsname << endl;
-    return;
-  }
-  
-  TFileMerger fm(kTRUE,kFALSE);
-  TString output(dsname);
-  
-  output.ReplaceAll("/","_");
-  output += ".merged";
-  
-  TIter next(fc->GetList());
-  TFileInfo* fi;
-  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
-  {
-    TUrl url(*(fi->GetFirstUrl()));
-    
-    cout << url.GetUrl() << endl;
-    cout << "Adding " << url.GetUrl() << flush;
-    fm.AddFile(url.GetUrl(),kFALSE);
-    cout << "done." << endl;
-  }
+  /// Read all the entries of the given tree in file (or only all its baskets
+  /// if level is kFastCheck), or only a sample of them if entryFraction < 1.
+  /// Return the number of entries read, or a negative value in case of problem.
+  /// When not verbose (e.g. when several files are tested at the same time)
+  /// only problems are reported
   
-  cout << "output=" << output.Data() << endl;
+  if (verbose) std::cout << "TestROOTFile " << file << " for tree " << treename << "..." << std::flush;
+  Long64_t size(0);
+  int rv(-1);
   
-  if (!DryRun())
+  if ( gSystem->AccessPathName(file) == 1 )
   {
-    fm.OutputFile(output.Data());
-    cout << "starting to merge" << endl;
-    fm.Merge();
+    if (verbose) std::cout << " does not exists" << std::endl;
+    return 1;
   }
   else
   {
-    cout << "DRY RUN ONLY. NO MERGING DONE" << endl;
+    TFile* f = TFile::Open(file);
+    if (!f)
+    {
+      std::cout << "Cannot open " << file << std::endl;
+      return -1;
+      
+    }
+    if (verbose) std::cout << " > " << std::flush;
+    size += f->GetSize();
+    if ( size > 0 )
+    {
+      UInt_t fileSeed = FileSeed(seed,file);
+      
+      rv = ( level == kFastCheck ) ? ReadBaskets(treename,entryFraction,fileSeed) : ReadTree(treename,entryFraction,fileSeed);
+    }
+    f->Close();
+    delete f;
   }
-}
-
-//______________________________________________________________________________
-void VAF::Print(Option_t* /*opt*/) const
-{
-  std::cout << ClassName()
-  << " talking to " << fMaster.Data() << std::endl
-  << " LogDir         :  " << fLogDir.Data() << std::endl
-  << " HomeDir        :  " << fHomeDir.Data() << std::endl
-  << " FileType       :  " << FileTypeToLookFor() << std::endl
-  << " DynamicDataSet : " << fIsDynamicDataSet << std::endl;
+  if (verbose) std::cout << Form("%10d entries read successfully",rv) << std::endl;
   
-  if ( fDryRun )
-  {
-    std::cout << "Currently in dry run mode " << std::endl;
-  }
+  if (rv<0) std::cout << "TestROOTFile : " << file << " has a problem" << std::endl;
+  return rv;
 }
 
 //______________________________________________________________________________
-void VAF::ReadIntegers(const char* filename, std::vector<int>& integers)
+void VAF::FindDuplicates(const char* filelist, int format, const char* occupancyFile)
 {
-  /// Read integers from filename, where integers are either
-  /// separated by "," or by return carriage
-  ifstream in(gSystem->ExpandPathName(filename));
-  int i;
-  
-  std::set<int> runset;
+  /// Get a list of duplicated files from an AFWebMaker output
+  /// Format=1 of the filelist ASCII file is :
+  ///
+  /// Day, dd.mm.yyyy hh:mm:ss size filefullpath server-name
+  ///
+  /// e.g.
+  ///
+  /// Mon, 16.03.2015 17:14:01 97949606 /alice/data/2015/LHC15c/000216293/raw/15000216293019.93.FILTER_RAWMUON_WITH_ALIPHYSICS_vAN-20150315.root SAF-nansaf01
+  ///
+  /// Format=2 of the filelist ASCII file is :
+  ///
+  /// logfilename:Day Month dd hh:mm:ss timezone year "/usr/local/saf-stage/bin/saf-stage.sh with parameters" source dest "returns xxx"
+  ///
+  /// e.g.
+  ///
+  /// nansaf01.in2p3.fr-saf_stage.log:Tue Sep  1 22:30:34 CEST 2015 /usr/local/saf-stage/bin/saf-stage.sh with parameters /alice/data/2011/LHC11h/000170387/raw/11000170387015.177.root /data/alice/data/2011/LHC11h/000170387/raw/11000170387015.177.root.anew returns 0
+  ///
+  /// The input is streamed once, and its (file, size, server) records spread, according
+  /// to the hash of the file path, over kDuplicatePartitions temporary files.
+  /// All the replicas of a given file end up in the same partition, which are then
+  /// looked at one by one, so the memory needed is bounded by the largest partition
+  /// (i.e. about 1/kDuplicatePartitions of the distinct files), whatever the input size.
+  /// The removal commands are written to remove-duplicates.sh as each partition
+  /// is done (so they are grouped by partition, not sorted), and only counts are printed.
+  ///
+  /// For each duplicated file, the copy kept is the one on the least loaded server.
+  /// The space used by a server is taken from the occupancyFile if given (one
+  /// "server used [capacity]" line per server, both in bytes, e.g. columns 3 and 2 of df -P -B1),
+  /// or else from the input itself (bytes, or number of files for format 2 where sizes are not known).
+  /// All servers are put on the same unit : servers missing from the occupancyFile get their
+  /// used space estimated from their number of files (format 2), and servers of unknown capacity
+  /// get the mean known capacity. The load is then used/capacity (just used if no capacity is known
+  /// at all), and is updated as duplicates are removed, by the file size (format 1) or by the mean
+  /// size of the files of the server (format 2). The projected balance is shown at the end.
   
-  char line[10000];
+  std::ifstream in(gSystem->ExpandPathName(filelist));
+  std::string line;
+  Long64_t size(0);
   
-  in.getline(line,10000,'\n');
+  // servers are interned (there are only a few of them), and referred to by their index
+  std::vector<std::string> servers;
+  std::map<std::string,UShort_t> serverIds;
+  std::vector<Double_t> used; // bytes (or files) per server
+  std::vector<Double_t> capacity; // bytes per server (0 if unknown)
+  std::vector<Double_t> nfiles; // files per server in the input
   
-  TString sline(line);
+  std::vector<std::string> partitionNames;
+  std::vector<std::ofstream*> partitions;
   
-  if (sline.Contains(","))
-  {
-    TObjArray* a = sline.Tokenize(",");
-    TIter next(a);
-    TObjString* s;
-    while ( ( s = static_cast<TObjString*>(next()) ) )
-    {
-      runset.insert(s->String().Atoi());
-    }
-    delete a;
-  }
-  else
+  for ( Int_t i = 0; i < kDuplicatePartitions; ++i )
   {
-    runset.insert(sline.Atoi());
+    partitionNames.push_back(Form("%s/findduplicates-%d-%02d.txt",gSystem->TempDirectory(),gSystem->GetPid(),i));
+    partitions.push_back(new std::ofstream(partitionNames.back().c_str()));
     
-    while ( in >> i )
+    if ( !partitions.back()->is_open() )
     {
-      runset.insert(i);
+      std::cout << "ERROR : cannot create " << partitionNames.back() << ", giving up" << std::endl;
+      
+      for ( std::vector<std::ofstream*>::size_type j = 0; j < partitions.size(); ++j )
+      {
+        delete partitions[j];
+        gSystem->Unlink(partitionNames[j].c_str());
+      }
+      return;
     }
   }
   
-  for ( std::set<int>::const_iterator it = runset.begin(); it != runset.end(); ++it )
-  {
-    integers.push_back((*it));
-  }
+  std::hash<std::string> hash;
   
-  std::sort(integers.begin(),integers.end());
-}
+  std::ofstream zout("remove-zeros.sh");
 
-//______________________________________________________________________________
-void VAF::RemoveDataFromOneDataSet(const char* dsName, std::ofstream& out)
-{
-  TFileCollection* fc = gProof->GetDataSet(dsName);
+  Long64_t count(0);
   
-  TIter next(fc->GetList());
-  TFileInfo* fi;
-  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+  std::vector<std::string> tokens;
+  
+  while ( std::getline(in,line) )
   {
-    TUrl url(*(fi->GetFirstUrl()));
+    if ( ++count % 1000000 == 0 )
+    {
+      std::cout << Form("%lld lines read",count) << std::endl;
+    }
+    
+    SplitLine(line,tokens);
+    
+    if ( tokens.size() < 6 || ( format != 1 && tokens.size() < 10 ) )
+    {
+      std::cout << "Skipping line " << count << " : " << line << std::endl;
+      continue;
+    }
+    
+    std::string file;
+    std::string server;
+    Long64_t thisSize(0);
+    
+    if ( format == 1 )
+    {
+      file = tokens[4];
+      thisSize = atoll(tokens[3].c_str());
+      server = tokens[5];
+      
+      if ( server.compare(0,4,"SAF-") == 0 ) server.erase(0,4);
+    }
+    else
+    {
+      file = tokens[9];
+      server = tokens[0].substr(0,tokens[0].find('.'));
+    }
+    
+    if (thisSize==0 && format==1)
+    {
+      zout << Form("echo \"xrd %s rm %s\"",server.c_str(),file.c_str()) << std::endl;
+      
+      continue;
+    }
+
+    size += thisSize;
+    
+    std::map<std::string,UShort_t>::const_iterator sit = serverIds.find(server);
+    UShort_t id;
     
-    if  (TString(url.GetHost()).Contains(fMaster.Data())) continue; // means not staged, so nothing to remove...
+    if ( sit == serverIds.end() )
+    {
+      id = servers.size();
+      serverIds[server] = id;
+      servers.push_back(server);
+      used.push_back(0.0);
+      capacity.push_back(0.0);
+      nfiles.push_back(0.0);
+    }
+    else
+    {
+      id = sit->second;
+    }
     
-    out << Form("echo \"xrd %s rm %s\"",url.GetHost(),url.GetFile()) << std::endl;
+    used[id] += ( format == 1 ? thisSize : 1 );
+    nfiles[id] += 1;
     
-    out << "xrd " << url.GetHost() << " rm " << url.GetFile() << std::endl;
+    *(partitions[hash(file) % kDuplicatePartitions]) << id << " " << thisSize << " " << file << "\n";
   }
   
-}
-
-//______________________________________________________________________________
-void VAF::RemoveDataFromOneDataSet(const char* dsName)
-{
-  if ( fConnect.Length()==0 ) return;
-  TProof::Open(fConnect.Data(),"masteronly");
-  if (!gProof) return;
+  zout.close();
   
-
-  std::ofstream out("delete-one-dataset.sh");
+  Bool_t written(kTRUE);
   
-  RemoveDataFromOneDataSet(dsName,out);
+  for ( Int_t i = 0; i < kDuplicatePartitions; ++i )
+  {
+    partitions[i]->close();
+    
+    if ( partitions[i]->fail() )
+    {
+      std::cout << "ERROR : could not write " << partitionNames[i] << std::endl;
+      written = kFALSE;
+    }
+    
+    delete partitions[i];
+  }
   
-  out.close();
-}
-
-//______________________________________________________________________________
-void VAF::RemoveDataFromDataSetFromFile(const char* dslist)
-{
-  if ( fConnect.Length()==0 ) return;
-  TProof::Open(fConnect.Data(),"masteronly");
-  if (!gProof) return;
-
-  std::ofstream out("delete-multiple-dataset.sh");
+  if (!written)
+  {
+    for ( Int_t i = 0; i < kDuplicatePartitions; ++i )
+    {
+      gSystem->Unlink(partitionNames[i].c_str());
+    }
+    return;
+  }
   
-  ifstream in(gSystem->ExpandPathName(dslist));
-  char line[1024];
+  std::vector<bool> inOccupancy(servers.size(),false);
   
-  while ( in.getline(line,1024,'\n') )
+  if ( strlen(occupancyFile) > 0 )
   {
-    std::cout << "Preparing cmd line for dataset " << line << std::endl;
-    RemoveDataFromOneDataSet(line,out);
+    std::ifstream oin(gSystem->ExpandPathName(occupancyFile));
+    
+    while ( std::getline(oin,line) )
+    {
+      SplitLine(line,tokens);
+      
+      if ( tokens.size() < 2 ) continue;
+      
+      // servers are known by their short name in the inventories
+      std::map<std::string,UShort_t>::const_iterator sit = serverIds.find(tokens[0].substr(0,tokens[0].find('.')));
+      
+      if ( sit == serverIds.end() ) continue;
+      
+      used[sit->second] = atof(tokens[1].c_str());
+      capacity[sit->second] = ( tokens.size() > 2 ) ? atof(tokens[2].c_str()) : 0.0;
+      inOccupancy[sit->second] = true;
+    }
   }
   
-  out.close();
-}
-
-//______________________________________________________________________________
-void VAF::RemoveDataSets(const char* dslist)
-{
-  if ( fConnect.Length()==0 ) return;
-  TProof::Open(fConnect.Data(),"masteronly");
-  if (!gProof) return;
-
-  ifstream in(gSystem->ExpandPathName(dslist));
-  char line[1024];
+  // put all the servers on the same unit
+  Double_t occupancyBytes(0);
+  Double_t occupancyFiles(0);
+  Double_t knownCapacity(0);
+  Int_t nknownCapacity(0);
   
-  while ( in.getline(line,1024,'\n') )
+  for ( std::vector<std::string>::size_type i = 0; i < servers.size(); ++i )
   {
-    std::cout << "Removing data set " << line << std::endl;
-    gProof->RemoveDataSet(line);
+    if ( inOccupancy[i] )
+    {
+      occupancyBytes += used[i];
+      occupancyFiles += nfiles[i];
+    }
+    if ( capacity[i] > 0 )
+    {
+      knownCapacity += capacity[i];
+      ++nknownCapacity;
+    }
   }
-}
-
-//______________________________________________________________________________
-void VAF::Reset(const char* option)
-{
-  UpdateConnectString();
   
-  TString soption(option);
-  soption.ToUpper();
-  Bool_t hard(kFALSE);
-  if ( soption.Contains("HARD") )
+  for ( std::vector<std::string>::size_type i = 0; i < servers.size(); ++i )
   {
-    hard = kTRUE;
+    // (with format 1 the input already gives bytes)
+    if ( format != 1 && !inOccupancy[i] && occupancyFiles > 0 )
+    {
+      used[i] = nfiles[i]*occupancyBytes/occupancyFiles;
+    }
+    if ( capacity[i] <= 0 && nknownCapacity > 0 )
+    {
+      capacity[i] = knownCapacity/nknownCapacity;
+    }
   }
   
-  TProof::Mgr(fConnect.Data())->Reset(hard);
-}
-
-//______________________________________________________________________________
-void VAF::ResetRoot()
-{
-  TProof::Mgr(fConnect.Data())->SetROOTVersion("current");
-}
-
-//______________________________________________________________________________
-void VAF::ShowDataSetContent(const char* dssetfile)
-{
-  /// Show the content of one or several datasets
-  
-  TList list;
-  list.SetOwner(kTRUE);
+  // what removing one file of a server frees, for format 2
+  std::vector<Double_t> fileSize(servers.size(),1.0);
   
-  if ( gSystem->AccessPathName(dssetfile) )
+  for ( std::vector<std::string>::size_type i = 0; i < servers.size(); ++i )
   {
-    // single dataset (i.e. not a text file containing a list of dataset...)
-    
-    std::cout << "INFO: " << dssetfile << " is not a file name, assuming it's a dataset" << std::endl;
-    list.Add(new TObjString(dssetfile));
+    if ( nfiles[i] > 0 ) fileSize[i] = used[i]/nfiles[i];
   }
-  else
+  
+  std::vector<Double_t> usedBefore(used);
+  
+  Long64_t dupSize(0);
+  int ndup(0);
+  Long64_t nremove(0);
+  
+  std::ofstream out("remove-duplicates.sh");
+  
+  for ( Int_t p = 0; p < kDuplicatePartitions; ++p )
   {
-    ifstream in(gSystem->ExpandPathName(dssetfile));
-    char line[1024];
+    std::unordered_map<std::string,FileReplicas> replicas;
     
-    while ( ( in.getline(line,1023,'\n') ) )
+    std::ifstream pin(partitionNames[p].c_str());
+    UShort_t id;
+    Long64_t thisSize;
+    std::string file;
+    
+    while ( pin >> id >> thisSize >> file )
     {
-      list.Add(new TObjString(line));
+      FileReplicas& r = replicas[file];
+      
+      r.fSize = thisSize;
+      r.fServers.push_back(id);
     }
-  }
-  
-  ShowDataSetContent(list);
-}
-
-//______________________________________________________________________________
-void VAF::ShowDataSetContent(const TList& list)
-{
-  if ( Connect() )
-  {
-    TIter next(&list);
-    TObjString* str;
     
-    while ( ( str = static_cast<TObjString*>(next())) )
+    pin.close();
+    gSystem->Unlink(partitionNames[p].c_str());
+    
+    for ( std::unordered_map<std::string,FileReplicas>::const_iterator it = replicas.begin(); it != replicas.end(); ++it )
     {
-      TFileCollection* fc = gProof->GetDataSet(str->String().Data());
-      if (!fc) continue;
+      const std::vector<UShort_t>& ids = it->second.fServers;
+      
+      if ( ids.size() < 2 ) continue;
       
-      TIter nextFileInfo(fc->GetList());
-      TFileInfo* fi;
-      while ( ( fi = static_cast<TFileInfo*>(nextFileInfo()) ) )
+      // keep the copy on the least loaded server
+      
+      std::vector<UShort_t>::size_type n(0);
+      
+      for ( std::vector<UShort_t>::size_type i = 1; i < ids.size(); ++i )
+      {
+        if ( ServerLoad(used,capacity,ids[i]) < ServerLoad(used,capacity,ids[n]) ) n = i;
+      }
+      
+      for ( std::vector<UShort_t>::size_type i = 0; i < ids.size(); ++i )
       {
-        TUrl url(*(fi->GetFirstUrl()));
+        if (i == n ) continue;
+        
+        used[ids[i]] -= ( format == 1 ? it->second.fSize : fileSize[ids[i]] );
         
-        cout << url.GetUrl() << endl;
+        out << Form("echo \"xrd %s rm %s\"",servers[ids[i]].c_str(),it->first.c_str()) << std::endl;
+        ++nremove;
       }
+      
+      dupSize += it->second.fSize;
+      
+      ++ndup;
     }
+    
+    std::cout << Form("Partition %2d/%d : %d duplicated files so far",p+1,kDuplicatePartitions,ndup) << std::endl;
   }
-}
-
-//______________________________________________________________________________
-void VAF::ShowDataSetList(const char* path)
-{
-  TList datasets;
-  GetDataSetList(datasets); // ,path);
-
-  TIter next(&datasets);
-  TObjString* dsName;
-
-  while ((dsName = static_cast<TObjString*>(next())))
-  {
-    if ( dsName->String().Contains(path) )
-    {
-      std::cout << dsName->String().Data() << std::endl;
-    }
-  }
-}
-
-//______________________________________________________________________________
-void VAF::ShowDataSets(const char* runlist)
-{
-  // Show all datasets for the runs in run list
-  std::vector<int> runs;
-  ReadIntegers(runlist,runs);
-  if (runs.empty()) return;
   
-  if ( Connect() )
-  {
-    for ( std::vector<int>::size_type i = 0; i < runs.size(); ++i )
-    {
-      ShowDataSetList(Form("*%d*",runs[i]));
-    }
-  }
-}
-
-//______________________________________________________________________________
-void VAF::ShowDiskUsage()
-{
-  if (Connect("workers=1x"))
+  out.close();
+  
+  std::cout << std::string(80,'_') << std::endl;
+  
+  std::cout << "Projected balance after the removal of the duplicates : " << std::endl;
+  
+  std::cout << std::string(80,'_') << std::endl;
+  
+  Double_t minBefore(0), maxBefore(0), minAfter(0), maxAfter(0);
+  
+  for ( std::vector<std::string>::size_type i = 0; i < servers.size(); ++i )
   {
-    TUrl u(gProof->GetDataPoolUrl());
+    Double_t before = ServerLoad(usedBefore,capacity,i);
+    Double_t after = ServerLoad(used,capacity,i);
     
-    gProof->Exec(Form(".!hostname ; df -h %s",u.GetFile()));
+    std::cout << Form("%-20s load %12.4g -> %12.4g",servers[i].c_str(),before,after) << std::endl;
+    
+    if ( i == 0 || before < minBefore ) minBefore = before;
+    if ( i == 0 || before > maxBefore ) maxBefore = before;
+    if ( i == 0 || after < minAfter ) minAfter = after;
+    if ( i == 0 || after > maxAfter ) maxAfter = after;
   }
+  
+  std::cout << Form("Load spread (max-min) %12.4g -> %12.4g",maxBefore-minBefore,maxAfter-minAfter) << std::endl;
+  
+  std::cout << std::string(80,'_') << std::endl;
+  
+  std::cout << nremove << " copies to be removed written to remove-duplicates.sh" << std::endl;
+  
+  std::cout << Form("%d duplicates. Their size is %7.2f GB (compared to a total size of %7.2f GB) ",ndup,dupSize/byte2GB,size/byte2GB) << std::endl;
+  
+  
 }
 
-//______________________________________________________________________________
-void VAF::ShowPackages()
+//_____________________________________________________________________________
+void VAF::GetBranchSizes(TTree* tree, Long64_t& zipBytes, Long64_t& totBytes, TObjArray* lines)
 {
-  if (Connect("masteronly"))
+  TObjArray* tb = tree->GetListOfBranches();
+  
+  if (!tb) return;
+  
+  tree->GetEntry(0);
+  
+  totBytes = tree->GetTotBytes();
+  zipBytes = tree->GetZipBytes();
+  
+  lines->Add(new TObjString(Form("== Tree %20s TotalBytes %4.0f KB AfterCompression %4.0f KB Nentries %lld",
+                                 tree->GetName(),totBytes/1024.0,zipBytes/1024.0,tree->GetEntries())));
+  
+  TBranch* b;
+  TIter next(tb);
+  
+  Float_t check100(0.0);
+  
+  while ( ( b = static_cast<TBranch*>(next()) ) )
   {
-    gProof->ShowPackages();
+    b->GetEntry(0);
+    
+    TString msg(Form("      %20s TotalBytes %10d (%4.0f %%) AfterCompression %10d (%4.0f %%)",
+                     b->GetName(),
+                     (Int_t)b->GetTotBytes("*"),
+                     (totBytes>0) ? b->GetTotBytes("*")*100.0/totBytes : 0,
+                     (Int_t)b->GetZipBytes("*"),
+                     (zipBytes>0) ? b->GetZipBytes("*")*100.0/zipBytes : 0
+                     ));
+    
+    check100 += (zipBytes>0) ? b->GetZipBytes("*")*100.0/zipBytes : 0;
+    
+    lines->Add(new TObjString(msg));
   }
-}
-
-//______________________________________________________________________________
-void VAF::ShowStagerLog()
-{
-  /// Dump on screen the log of the stager daemon
-  if (Connect("masteronly"))
+  
+  TBranch* br = tree->BranchRef();
+  
+  if (br)
   {
-    gProof->Exec(Form(".!cat %s/afdsmgrd/afdsmgrd.log",LogDir().Data()),"0");
+    TString msg(Form("      %20s AfterCompression %10d (%5.2f %% of file size)",
+                     br->GetName(),(Int_t)br->GetZipBytes("*"),
+                     br->GetZipBytes("*")*100.0/zipBytes
+                     ));
+    lines->Add(new TObjString(msg));
   }
+  
+  lines->Add(new TObjString(Form("check100 = %f",check100)));
+  
 }
 
-//______________________________________________________________________________
-void VAF::ShowXferLog(const char* file)
+//_____________________________________________________________________________
+void VAF::PrintB(const TObjArray& lines)
 {
-  if (Connect("workers=1x"))
+  TIter next(&lines);
+  TObjString* str;
+  while ( ( str = static_cast<TObjString*>(next()) ) )
   {
-//    gProof->Exec(Form(".!hostname ; cat %s/xrootd/xrddm/%s/xrddm_*.log",LogDir().Data(),file));
-    gProof->Exec(Form(".!hostname ; cat %s/xrootd/data/%s.anew/saf-stage.log",LogDir().Data(),file));
+    if ( str->String().BeginsWith("==") ) std::cout << std::endl << std::endl;
+    std::cout << str->String() << std::endl;
   }
 }
 
+
 //______________________________________________________________________________
-void VAF::ShowXrdDmLog()
+void VAF::GetFileList(const char* input, std::vector<std::string>& files)
 {
-  if (Connect("workers=1x"))
+  /// Get the list of files designated by input, which can be one ROOT file,
+  /// a text file with one file per line, or a dataset (in which case only
+  /// its staged and not corrupted files are considered)
+  
+  files.clear();
+  
+  TString sinput(input);
+  
+  if ( sinput.EndsWith(".root") || sinput.Contains("://") )
   {
-    gProof->Exec(Form(".!echo '**************************************'; hostname -a ; cat %s/xrootd/xrddm.log",LogDir().Data()));
-    gProof->Exec(".!echo '++++++++++++++++++++++++++++++++++++++'; hostname -a ; cat /var/log/xrootd/xrddm.log");
-//    gProof->Exec(".!echo '++++++++++++++++++++++++++++++++++++++'; hostname -a ; tail -100 /var/log/xrootd/saf_stage.log");
+    files.push_back(input);
+    return;
   }
   
-}
-
-//______________________________________________________________________________
-void VAF::ShowLog()
-{
-  if (Connect("workers=1x"))
+  TString textFile(input);
+  
+  gSystem->ExpandPathName(textFile);
+  
+  if ( !gSystem->AccessPathName(textFile.Data()) )
   {
-    gProof->Exec(".!echo '++++++++++++++++++++++++++++++++++++++'; hostname -a ; tail -100 /var/log/xrootd/saf_stage.log");
+    std::ifstream in(textFile.Data());
+    std::string line;
+    
+    while ( std::getline(in,line) )
+    {
+      TString file(line.c_str());
+      file = file.Strip(TString::kBoth);
+      if ( file.Length() > 0 ) files.push_back(file.Data());
+    }
+    return;
   }
   
-}
-
-//______________________________________________________________________________
-void VAF::ShowTransfers()
-{
-  /// Show CpMacro* transfers
+  std::unique_ptr<TFileCollection> fc(GetDataSet(input));
   
-  if ( Connect("workers=1x") )
+  if (!fc)
   {
-    gProof->Exec(".!hostname ; ps -edf | grep CpMacro | grep root.exe | grep -v ps | grep -v sh | wc -l");
+    std::cout << "cannot get dataset " << input << std::endl;
+    return;
   }
   
-}
-
-//______________________________________________________________________________
-void VAF::ShowConfig()
-{
-   if (Connect("workers=1x"))
-   {
-     std::vector<std::string> files;
-     
-     files.push_back("%s/proof/xproofd/prf-main.cf");
-     files.push_back("%s/xrootd/etc/xrootd/xrootd.cf");
-     files.push_back("%s/proof/xproofd/afdsmgrd.conf");
-     files.push_back("%s/xrootd/scripts/frm-stage-with-xrddm.sh");
-     files.push_back("%s/xrootd/scripts/frm-stage-with-saf-stage.sh");
-     files.push_back("/usr/local/xrddm/etc/xrddm_env.sh");
-     files.push_back("/usr/local/xrddm/etc/xrddm.cfg");
-     
-     TString cmd(".!");
-     
-     for (std::vector<std::string>::size_type i = 0; i < files.size(); ++i )
-     {
-       TString thefile;
-       
-       thefile.Form(files[i].c_str(),HomeDir().Data());
-       
-       cmd += "echo '************* ";
-       cmd += thefile;
-       cmd += " **********' ; cat ";
-       cmd += thefile;
-       cmd += ";";
-     }
-     
-     gProof->Exec(cmd.Data());
-   }
-}
-
-//______________________________________________________________________________
-int VAF::ReadTree(const char* treename)
-{
-  TTree* tree = static_cast<TTree*>(gDirectory->Get(treename));
-  if (!tree) return -2;
-  
-  Long64_t nentries = tree->GetEntries();
+  TIter next(fc->GetList());
+  TFileInfo* fi;
   
-  for (Long64_t i = 0; i < nentries; ++i)
+  while ( ( fi = static_cast<TFileInfo*>(next()) ) )
   {
-    if ( tree->GetEntry(i) <= 0 ) return -2;
+    if (!fi->TestBit(TFileInfo::kStaged) || fi->TestBit(TFileInfo::kCorrupted)) continue;
+    
+    files.push_back(fi->GetFirstUrl()->GetUrl());
   }
-  
-  return nentries;
 }
 
 //______________________________________________________________________________
-void VAF::TestDataSets(const char* txtfile, Bool_t requestStagingIfNotStaged)
+void VAF::ProfileBranchSizes(const char* input, const char* output, const char* format)
 {
-  /// Check if the datasets in the txtfile are already staged.
-  /// If not, and if requestStagingIfNotStaged is true, will launch a staging request
-  
-  if (!Connect("masteronly")) return;
+  /// Aggregate the compressed and uncompressed sizes of every branch (sub-branches
+  /// included) of every tree, across all the files of input (see GetFileList),
+  /// and write them, largest compressed size first, to output, as csv or json (format).
+  ///
+  /// Only the file keys and the branch (basket) metadata are read, no entry at all,
+  /// and the files are looked at Parallelism() at a time.
   
-  std::ifstream in(gSystem->ExpandPathName(txtfile));
-  std::string line;
+  std::vector<std::string> files;
   
-  std::vector<std::string> msgs;
-  std::vector<std::string> requests;
+  GetFileList(input,files);
   
-  Long64_t totalSize(0);
+  std::map<std::string,BranchSize> sizes;
+  std::mutex mutex;
+  Int_t nbad(0);
   
-  // loop on text file
-  while (std::getline(in,line))
+  AFParallel::ForEach(files.size(),Parallelism(),[&](std::size_t i)
   {
-    TFileCollection* fc = gProof->GetDataSet(line.c_str());
-    if (!fc)
+    std::unique_ptr<TFile> file(TFile::Open(files[i].c_str()));
+    
+    if (!file)
     {
-      msgs.push_back(Form("%s does not exist (query return nothing)",line.c_str()));
-      continue;
+      std::lock_guard<std::mutex> lock(mutex);
+      std::cout << "Cannot open " << files[i] << std::endl;
+      ++nbad;
+      return;
     }
     
-    if ( fc->GetNStagedFiles() == 0 || fc->GetStagedPercentage() < 100.0 )
+    std::map<std::string,BranchSize> local;
+    std::set<std::string> trees;
+    
+    TIter nextKey(file->GetListOfKeys());
+    TKey* key;
+    
+    while ( ( key = static_cast<TKey*>(nextKey()) ) )
     {
-      delete fc;
-      std::string lineup = line;
+      // keys come highest cycle first, the other cycles are just backups
+      if ( TString(key->GetClassName()) != "TTree" || !trees.insert(key->GetName()).second ) continue;
       
-      // if nothing staged yet, check first if it's not the caching
-      // mechanism that is giving us an outdated answer
-      lineup += ";ForceUpdate";
+      std::unique_ptr<TTree> tree(static_cast<TTree*>(key->ReadObj()));
       
-      fc = gProof->GetDataSet(lineup.c_str());
+      if (!tree) continue;
       
-      if ( fc->GetNStagedFiles() == 0 || fc->GetStagedPercentage() < 100.0 )
+      std::vector<TBranch*> branches;
+      
+      GetAllBranches(tree->GetListOfBranches(),branches);
+      
+      if ( tree->BranchRef() ) branches.push_back(tree->BranchRef());
+      
+      for ( std::vector<TBranch*>::size_type b = 0; b < branches.size(); ++b )
       {
-        // no, that's not the cache's fault, the files are actually not staged.
-        // so they'll need to be requested
-        requests.push_back(line.c_str());
+        BranchSize& s = local[std::string(tree->GetName()) + "," + branches[b]->GetName()];
+        
+        // own baskets only, as sub-branches are in the list as well
+        s.fZipBytes += branches[b]->GetZipBytes("");
+        s.fTotBytes += branches[b]->GetTotBytes("");
+        s.fEntries += branches[b]->GetEntries();
+        s.fNFiles += 1;
       }
     }
     
-    totalSize += fc->GetTotalSize();
-    
-    msgs.push_back(Form("%s staged %4.0f %% nfiles %4lld nstaged %4lld size %6d MB",line.c_str(),fc->GetStagedPercentage(),fc->GetNFiles(),fc->GetNStagedFiles(),TMath::Nint(fc->GetTotalSize()/byte2MB*1.0)));
+    std::lock_guard<std::mutex> lock(mutex);
     
-  }
-
-  // printout
-  std::vector<std::string>::size_type i;
-
-  for ( i = 0 ; i < msgs.size(); ++i )
+    for ( std::map<std::string,BranchSize>::const_iterator it = local.begin(); it != local.end(); ++it )
+    {
+      BranchSize& s = sizes[it->first];
+      
+      s.fZipBytes += it->second.fZipBytes;
+      s.fTotBytes += it->second.fTotBytes;
+      s.fEntries += it->second.fEntries;
+      s.fNFiles += it->second.fNFiles;
+    }
+  });
+  
+  std::vector<std::pair<Long64_t,std::string> > order;
+  Long64_t totalZip(0);
+  
+  for ( std::map<std::string,BranchSize>::const_iterator it = sizes.begin(); it != sizes.end(); ++it )
   {
-    std::cout << msgs[i] << std::endl;
+    order.push_back(std::make_pair(it->second.fZipBytes,it->first));
+    totalZip += it->second.fZipBytes;
   }
-
-  std::cout << Form("Total size %7.3f GB",totalSize/byte2GB) << std::endl;
   
-  if (requests.size())
+  std::sort(order.rbegin(),order.rend());
+  
+  Bool_t json = ( TString(format) == "json" );
+  
+  std::ofstream out(gSystem->ExpandPathName(output));
+  
+  out << ( json ? "[" : "tree,branch,nfiles,entries,totbytes,zipbytes,ratio,fraction" ) << std::endl;
+  
+  for ( std::vector<std::pair<Long64_t,std::string> >::size_type i = 0; i < order.size(); ++i )
   {
-    if (!requestStagingIfNotStaged)
+    const BranchSize& s = sizes[order[i].second];
+    std::string::size_type ix = order[i].second.find(',');
+    std::string tree = order[i].second.substr(0,ix);
+    std::string branch = order[i].second.substr(ix+1);
+    Double_t ratio = s.fZipBytes > 0 ? s.fTotBytes*1.0/s.fZipBytes : 0.0;
+    Double_t fraction = totalZip > 0 ? s.fZipBytes*1.0/totalZip : 0.0;
+    
+    if (json)
     {
-      std::cout << "The following staging requests would have to be performed" << std::endl;
+      out << Form("%s{\"tree\":\"%s\",\"branch\":\"%s\",\"nfiles\":%d,\"entries\":%lld,\"totbytes\":%lld,\"zipbytes\":%lld,\"ratio\":%g,\"fraction\":%g}",
+                  i > 0 ? "," : "",tree.c_str(),branch.c_str(),s.fNFiles,s.fEntries,s.fTotBytes,s.fZipBytes,ratio,fraction) << std::endl;
     }
-    
-    for ( i = 0 ; i < requests.size(); ++i )
+    else
     {
-      std::cout << requests[i] << std::endl;
-      if (requestStagingIfNotStaged)
-      {
-        gProof->RequestStagingDataSet(requests[i].c_str());
-      }
+      out << Form("%s,%s,%d,%lld,%lld,%lld,%g,%g",tree.c_str(),branch.c_str(),s.fNFiles,s.fEntries,s.fTotBytes,s.fZipBytes,ratio,fraction) << std::endl;
     }
   }
-
+  
+  if (json) out << "]" << std::endl;
+  
+  out.close();
+  
+  std::cout << Form("%lu branches from %lu files (%d could not be opened), %7.2f GB compressed, written to %s",
+                    order.size(),files.size(),nbad,totalZip/byte2GB,output) << std::endl;
 }
 
 //______________________________________________________________________________
-int VAF::TestROOTFile(const char* file, const char* treename)
+void VAF::AdviseCompression(const char* input, const char* output, Int_t basketsPerBranch, Int_t maxFiles)
 {
-  std::cout << "TestROOTFile " << file << " for tree " << treename << "..." << std::flush;
-  Long64_t size(0);
-  int rv(-1);
+  /// Tell what recompressing the trees of input (see GetFileList) with each
+  /// available ROOT compression algorithm and level would give.
+  ///
+  /// Up to basketsPerBranch baskets (evenly spread) of every branch of up to maxFiles
+  /// files (evenly spread as well) are read, decompressed, and recompressed with each setting.
+  /// The projected size of each branch is its current compressed size scaled by the ratio
+  /// observed on its sampled baskets, and the decompression throughput (uncompressed MB/s)
+  /// is measured on the recompressed baskets. Files are done one after the other so that
+  /// the timings are not disturbed.
+  /// The per branch results are written to output (csv), and the totals are printed.
   
-  if ( gSystem->AccessPathName(file) == 1 )
-  {
-    std::cout << " does not exists" << std::endl;
-    return 1;
-  }
-  else
+  std::vector<std::string> files;
+  
+  GetFileList(input,files);
+  
+  if ( maxFiles > 0 && files.size() > static_cast<std::size_t>(maxFiles) )
   {
-    TFile* f = TFile::Open(file);
-    if (!f)
-    {
-      std::cout << "Cannot open " << file << std::endl;
-      return -1;
-      
-    }
-    std::cout << " > " << std::flush;
-    size += f->GetSize();
-    if ( size > 0 )
+    std::vector<std::string> sample;
+    
+    for ( Int_t i = 0; i < maxFiles; ++i )
     {
-      rv = ReadTree(treename);
+      sample.push_back(files[i*files.size()/maxFiles]);
     }
-    f->Close();
-    delete f;
+    files.swap(sample);
   }
-  std::cout << Form("%10d entries read successfully",rv) << std::endl;
   
-  if (rv<0) std::cout << "TestROOTFile : " << file << " has a problem" << std::endl;
-  return rv;
-}
-
-//______________________________________________________________________________
-void VAF::FindDuplicates(const char* filelist, int format)
-{
-  /// Get a list of duplicated files from an AFWebMaker output
-  /// Format=1 of the filelist ASCII file is :
-  ///
-  /// Day, dd.mm.yyyy hh:mm:ss size filefullpath server-name
-  ///
-  /// e.g.
-  ///
-  /// Mon, 16.03.2015 17:14:01 97949606 /alice/data/2015/LHC15c/000216293/raw/15000216293019.93.FILTER_RAWMUON_WITH_ALIPHYSICS_vAN-20150315.root SAF-nansaf01
-  ///
-  /// Format=2 of the filelist ASCII file is :
-  ///
-  /// logfilename:Day Month dd hh:mm:ss timezone year "/usr/local/saf-stage/bin/saf-stage.sh with parameters" source dest "returns xxx"
-  ///
-  /// e.g.
-  ///
-  /// nansaf01.in2p3.fr-saf_stage.log:Tue Sep  1 22:30:34 CEST 2015 /usr/local/saf-stage/bin/saf-stage.sh with parameters /alice/data/2011/LHC11h/000170387/raw/11000170387015.177.root /data/alice/data/2011/LHC11h/000170387/raw/11000170387015.177.root.anew returns 0
+  std::vector<Int_t> settings;
   
-  new TRandom3;
+  for ( Int_t i = 0; kCompressionSettings[i] > 0; ++i )
+  {
+    settings.push_back(kCompressionSettings[i]);
+  }
   
-  std::ifstream in(gSystem->ExpandPathName(filelist));
-  std::string line;
-  TObjArray* a;
-  Long64_t size(0);
-  std::map<std::string,std::string> fileServers;
-  std::map<std::string,Long64_t> fileSize;
-  std::vector<std::string> dup;
+  // per "tree,branch" : current sizes, and per setting the sampled results
+  std::map<std::string,BranchSize> current;
+  std::map<std::string,Long64_t> sampledZip;
+  std::map<std::string,std::vector<CompressionSample> > samples;
   
-  std::ofstream zout("remove-zeros.sh");
-
-  int count(0);
+  std::vector<char> compressed;
+  std::vector<char> decompressed;
   
-  while ( std::getline(in,line) )
+  for ( std::vector<std::string>::size_type f = 0; f < files.size(); ++f )
   {
-    std::cout << Form("%6d %s",++count,line.c_str()) << std::endl;
+    std::unique_ptr<TFile> file(TFile::Open(files[f].c_str()));
     
-//    if ( !TString(line).Contains("169099")) continue;
-    
-    a = TString(line.c_str()).Tokenize(" ");
-
-    if ( a->GetLast()<5 )
+    if (!file)
     {
-      a->Print();
+      std::cout << "Cannot open " << files[f] << std::endl;
       continue;
     }
     
-    TObjString* sfile;
-    TObjString* ssize;
-    TObjString* sserver;
-    int thisSize = 0;
+    std::cout << "Sampling " << files[f] << std::endl;
     
-    if ( format ==1 )
-    {
-      sfile = static_cast<TObjString*>(a->At(4));
-    
-      ssize = static_cast<TObjString*>(a->At(3));
+    std::set<std::string> trees;
+    TIter nextKey(file->GetListOfKeys());
+    TKey* key;
     
-      sserver = static_cast<TObjString*>(a->At(5));
-      
-      thisSize = ssize->String().Atoi();
-      
-    }
-    else
+    while ( ( key = static_cast<TKey*>(nextKey()) ) )
     {
-      sfile = static_cast<TObjString*>(a->At(9));
+      if ( TString(key->GetClassName()) != "TTree" || !trees.insert(key->GetName()).second ) continue;
       
-      sserver = static_cast<TObjString*>(a->At(0));
-    }
-    
-    TString server = sserver->String();
-    
-    if ( format == 1 )
-    {
-      server.ReplaceAll("SAF-","");
-    }
-    else
+      std::unique_ptr<TTree> tree(static_cast<TTree*>(key->ReadObj()));
       
-    {
-      std::cout << "HERE:" << server.Data() << "!" << std::endl;
-      Int_t i = server.Index('.');
-      server = server(0,i);
-      std::cout << ">>>" << server.Data() << "!" << std::endl;
-    }
-
-    if (thisSize==0 && format==1)
-    {
-      zout << Form("echo \"xrd %s rm %s\"",server.Data(),sfile->String().Data()) << std::endl;
+      if (!tree) continue;
       
-      continue;
-    }
-
-    size += thisSize;
-
-    fileServers[sfile->String().Data()] += server;
-    fileServers[sfile->String().Data()] += " ";
-    
-    fileSize[sfile->String().Data()] = thisSize;
-    
-    delete a;
-  }
-  
-  zout.close();
-  
-  std::map<std::string,std::string>::const_iterator it;
-  Long64_t dupSize(0);
-  int ndup(0);
-  
-  std::ofstream out("remove-duplicates.sh");
-
-  for ( it = fileServers.begin(); it != fileServers.end(); ++it )
-  {
-    a = TString(it->second.c_str()).Tokenize(" ");
-    
-      if ( a->GetLast() > 0 )
+      std::vector<TBranch*> branches;
+      
+      GetAllBranches(tree->GetListOfBranches(),branches);
+      
+      for ( std::vector<TBranch*>::size_type b = 0; b < branches.size(); ++b )
       {
-        std::cout << it->first.c_str() << " -> " << it->second << std::endl;
-        // pick one (randomly) to be the one we keep
+        TBranch* branch = branches[b];
+        std::string name = std::string(tree->GetName()) + "," + branch->GetName();
+        
+        BranchSize& s = current[name];
+        
+        s.fZipBytes += branch->GetZipBytes("");
+        s.fTotBytes += branch->GetTotBytes("");
+        s.fNFiles += 1;
+        
+        std::vector<CompressionSample>& results = samples[name];
         
-        int n = TMath::Nint(gRandom->Uniform(0,a->GetLast()));
+        results.resize(settings.size());
         
-        for ( int i = 0; i <= a->GetLast(); ++i )
+        Int_t nbaskets = branch->GetWriteBasket();
+        Int_t nsample = TMath::Min(nbaskets,basketsPerBranch);
+        
+        for ( Int_t i = 0; i < nsample; ++i )
         {
-          if (i == n ) continue;
+          Int_t ib = i*nbaskets/nsample;
+          TBasket* basket = branch->GetBasket(ib);
           
-          TString server = static_cast<TObjString*>(a->At(i))->String();
+          if (!basket) continue;
           
-          server.ReplaceAll("SAF-","");
-
-          out << Form("echo \"xrd %s rm %s\"",server.Data(),it->first.c_str()) << std::endl;
-
-          dup.push_back(Form("%s:%s",it->first.c_str(),server.Data()));
+          char* src = basket->GetBufferRef()->Buffer() + basket->GetKeylen();
+          Int_t srcsize = basket->GetObjlen();
+          
+          sampledZip[name] += basket->GetNbytes() - basket->GetKeylen();
+          
+          for ( std::vector<Int_t>::size_type is = 0; is < settings.size(); ++is )
+          {
+            std::vector<Int_t> chunks;
+            
+            Int_t zipped = Compress(settings[is],src,srcsize,compressed,chunks);
+            
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            
+            Decompress(compressed,chunks,srcsize,decompressed);
+            
+            std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+            
+            results[is].fRawBytes += srcsize;
+            results[is].fZipBytes += zipped;
+            results[is].fTime += dt.count();
+          }
+          
+          branch->DropBaskets("all");
         }
-        
-        dupSize += fileSize[it->first.c_str()];
-        
-        ++ndup;
       }
-    delete a;
-  }
-
-  out.close();
-  
-  std::cout << std::string(80,'_') << std::endl;
-
-  std::cout << "Selected duplicates : " << std::endl;
-  
-  std::cout << std::string(80,'_') << std::endl;
-  
-  std::sort(dup.begin(),dup.end());
-  
-  for ( std::vector<std::string>::size_type i = 0; i < dup.size(); ++i )
-  {
-    std::cout << dup[i].c_str() << std::endl;
-    
+    }
   }
-  std::cout << dup.size() << std::endl;
-
-  
-  std::cout << Form("%d duplicates. Their size is %7.2f GB (compared to a total size of %7.2f GB) ",ndup,dupSize/byte2GB,size/byte2GB) << std::endl;
-  
-  
-}
-
-//_____________________________________________________________________________
-void VAF::GetBranchSizes(TTree* tree, Long64_t& zipBytes, Long64_t& totBytes, TObjArray* lines)
-{
-  TObjArray* tb = tree->GetListOfBranches();
-  
-  if (!tb) return;
-  
-  tree->GetEntry(0);
-  
-  totBytes = tree->GetTotBytes();
-  zipBytes = tree->GetZipBytes();
   
-  lines->Add(new TObjString(Form("== Tree %20s TotalBytes %4.0f KB AfterCompression %4.0f KB Nentries %lld",
-                                 tree->GetName(),totBytes/1024.0,zipBytes/1024.0,tree->GetEntries())));
+  std::ofstream out(gSystem->ExpandPathName(output));
   
-  TBranch* b;
-  TIter next(tb);
+  out << "tree,branch,setting,algorithm,level,zipbytes,projected,ratio,decompression_mb_s" << std::endl;
   
-  Float_t check100(0.0);
+  std::vector<Double_t> totalProjected(settings.size(),0.0);
+  std::vector<Double_t> totalRaw(settings.size(),0.0);
+  std::vector<Double_t> totalTime(settings.size(),0.0);
+  Long64_t totalZip(0);
   
-  while ( ( b = static_cast<TBranch*>(next()) ) )
+  for ( std::map<std::string,BranchSize>::const_iterator it = current.begin(); it != current.end(); ++it )
   {
-    b->GetEntry(0);
-    
-    TString msg(Form("      %20s TotalBytes %10d (%4.0f %%) AfterCompression %10d (%4.0f %%)",
-                     b->GetName(),
-                     (Int_t)b->GetTotBytes("*"),
-                     (totBytes>0) ? b->GetTotBytes("*")*100.0/totBytes : 0,
-                     (Int_t)b->GetZipBytes("*"),
-                     (zipBytes>0) ? b->GetZipBytes("*")*100.0/zipBytes : 0
-                     ));
+    const std::vector<CompressionSample>& results = samples[it->first];
+    Long64_t sampled = sampledZip[it->first];
     
-    check100 += (zipBytes>0) ? b->GetZipBytes("*")*100.0/zipBytes : 0;
+    totalZip += it->second.fZipBytes;
     
-    lines->Add(new TObjString(msg));
+    for ( std::vector<Int_t>::size_type is = 0; is < settings.size(); ++is )
+    {
+      const CompressionSample& r = results[is];
+      
+      // branches with no sampled basket are projected as they are
+      Double_t projected = ( sampled > 0 ) ? it->second.fZipBytes*1.0*r.fZipBytes/sampled : it->second.fZipBytes;
+      Double_t throughput = r.fTime > 0 ? r.fRawBytes/byte2MB/r.fTime : 0.0;
+      
+      totalProjected[is] += projected;
+      totalRaw[is] += r.fRawBytes;
+      totalTime[is] += r.fTime;
+      
+      out << Form("%s,%d,%s,%d,%lld,%.0f,%g,%g",it->first.c_str(),settings[is],
+                  CompressionAlgorithmName(settings[is]/100),settings[is]%100,
+                  it->second.fZipBytes,projected,
+                  projected > 0 ? it->second.fTotBytes/projected : 0.0,throughput) << std::endl;
+    }
   }
   
-  TBranch* br = tree->BranchRef();
-  
-  if (br)
-  {
-    TString msg(Form("      %20s AfterCompression %10d (%5.2f %% of file size)",
-                     br->GetName(),(Int_t)br->GetZipBytes("*"),
-                     br->GetZipBytes("*")*100.0/zipBytes
-                     ));
-    lines->Add(new TObjString(msg));
-  }
+  out.close();
   
-  lines->Add(new TObjString(Form("check100 = %f",check100)));
+  std::cout << std::string(80,'_') << std::endl;
+  std::cout << Form("Current compressed size %7.2f GB (%lu files sampled)",totalZip/byte2GB,files.size()) << std::endl;
   
-}
-
-//_____________________________________________________________________________
-void VAF::PrintB(const TObjArray& lines)
-{
-  TIter next(&lines);
-  TObjString* str;
-  while ( ( str = static_cast<TObjString*>(next()) ) )
+  for ( std::vector<Int_t>::size_type is = 0; is < settings.size(); ++is )
   {
-    if ( str->String().BeginsWith("==") ) std::cout << std::endl << std::endl;
-    std::cout << str->String() << std::endl;
+    std::cout << Form("%5s level %d : projected %7.2f GB (%+6.1f %%) decompression %8.1f MB/s",
+                      CompressionAlgorithmName(settings[is]/100),settings[is]%100,
+                      totalProjected[is]/byte2GB,
+                      totalZip > 0 ? ( totalProjected[is] - totalZip )*100.0/totalZip : 0.0,
+                      totalTime[is] > 0 ? totalRaw[is]/byte2MB/totalTime[is] : 0.0) << std::endl;
   }
+  
+  std::cout << "Per branch results written to " << output << std::endl;
 }
 
-
 //______________________________________________________________________________
 void VAF::RootFileSize(const char* filename, Bool_t showBranches)
 {
@@ -1936,3 +4500,334 @@ void VAF::ExtractFileList(const char* datasetDir, const char* serverName)
   delete f;
 }
 
+//_______________________________________________________________________
+void VAF::BuildServerIndex(const char* datasetDir, const char* indexDir, Bool_t rebuild)
+{
+  /// Maintain in indexDir, for every data server, the list of the files it holds,
+  /// as found in the *.root dataset files of datasetDir :
+  ///
+  /// - indexDir/<server>.idx : one "dataset size url" line per file (used by ServerImpact)
+  /// - indexDir/<server>.list : one alien:// url per line (as ExtractFileList finds them,
+  ///   and as repopulate/list-input.sh expects them)
+  ///
+  /// where <server> is the short name of the server (e.g. nansaf10), as for FindDuplicates.
+  /// - indexDir/manifest.txt : modification time, size and servers of each indexed dataset file
+  ///
+  /// Only the dataset files that changed (or appeared) since the last call are read
+  /// (Parallelism() at a time), and only the servers concerned by those changes (or by
+  /// datasets that disappeared) get their index rewritten. With rebuild everything is redone.
+  
+  TString dsdir(datasetDir);
+  TString idxdir(indexDir);
+  
+  gSystem->ExpandPathName(dsdir);
+  gSystem->ExpandPathName(idxdir);
+  
+  std::map<std::string,IndexedDataSet> manifest;
+  std::set<std::string> touched;
+  
+  if (!rebuild)
+  {
+    ReadServerIndexManifest(idxdir,manifest);
+    
+    // indices made when the servers were known by their full name are redone
+    for ( std::map<std::string,IndexedDataSet>::const_iterator it = manifest.begin(); it != manifest.end() && !rebuild; ++it )
+    {
+      for ( std::set<std::string>::const_iterator s = it->second.fServers.begin(); s != it->second.fServers.end(); ++s )
+      {
+        if ( *s != ShortHost(*s) ) rebuild = kTRUE;
+      }
+    }
+    
+    if (rebuild)
+    {
+      std::cout << "Index of " << idxdir.Data() << " uses full server names : rebuilding it" << std::endl;
+      manifest.clear();
+    }
+  }
+  
+  if (rebuild)
+  {
+    // forget about all the existing servers
+    void* idxp = gSystem->OpenDirectory(idxdir.Data());
+    const char* name;
+    
+    while ( idxp && ( name = gSystem->GetDirEntry(idxp) ) )
+    {
+      TString sname(name);
+      
+      if ( sname.EndsWith(".idx") ) touched.insert(sname(0,sname.Length()-4).Data());
+    }
+    
+    if (idxp) gSystem->FreeDirectory(idxp);
+  }
+  
+  void* dirp = gSystem->OpenDirectory(dsdir.Data());
+  
+  if (!dirp)
+  {
+    std::cout << "Cannot open directory " << dsdir.Data() << std::endl;
+    return;
+  }
+  
+  std::set<std::string> present;
+  std::vector<std::string> changed;
+  std::map<std::string,IndexedDataSet> updated;
+  const char* name;
+  
+  while ( ( name = gSystem->GetDirEntry(dirp) ) )
+  {
+    TString sname(name);
+    
+    if ( !sname.EndsWith(".root") ) continue;
+    
+    std::string dsname(sname(0,sname.Length()-5).Data());
+    FileStat_t st;
+    
+    if ( gSystem->GetPathInfo(Form("%s/%s",dsdir.Data(),name),st) ) continue;
+    
+    present.insert(dsname);
+    
+    std::map<std::string,IndexedDataSet>::const_iterator it = manifest.find(dsname);
+    
+    if ( it == manifest.end() || it->second.fModTime != st.fMtime || it->second.fSize != st.fSize )
+    {
+      changed.push_back(dsname);
+      updated[dsname].fModTime = st.fMtime;
+      updated[dsname].fSize = st.fSize;
+    }
+  }
+  
+  gSystem->FreeDirectory(dirp);
+  
+  std::set<std::string> gone;
+  
+  for ( std::map<std::string,IndexedDataSet>::const_iterator it = manifest.begin(); it != manifest.end(); ++it )
+  {
+    if ( !present.count(it->first) ) gone.insert(it->first);
+  }
+  
+  // new contents of the changed datasets, per server
+  std::map<std::string,std::vector<IndexedFile> > added;
+  std::mutex mutex;
+  Int_t nbad(0);
+  
+  AFParallel::ForEach(changed.size(),Parallelism(),[&](std::size_t i)
+  {
+    const std::string& dsname = changed[i];
+    std::unique_ptr<TFile> f(TFile::Open(Form("%s/%s.root",dsdir.Data(),dsname.c_str())));
+    std::unique_ptr<TFileCollection> fc(f ? static_cast<TFileCollection*>(f->Get("dataset")) : 0x0);
+    
+    if (!fc)
+    {
+      // keep whatever we knew about it, it will be retried next time
+      std::lock_guard<std::mutex> lock(mutex);
+      std::cout << "Cannot read dataset from " << dsname << std::endl;
+      updated.erase(dsname);
+      ++nbad;
+      return;
+    }
+    
+    std::map<std::string,std::vector<IndexedFile> > local;
+    TIter next(fc->GetList());
+    TFileInfo* fi;
+    
+    while ( ( fi = static_cast<TFileInfo*>(next()) ) )
+    {
+      // the first url is where the file actually is
+      const TUrl* url = fi->GetFirstUrl();
+      
+      if (!url || !strlen(url->GetHost())) continue;
+      
+      IndexedFile file;
+      
+      file.fDataSet = dsname;
+      file.fSize = fi->GetSize();
+      file.fUrl = Form("alien://%s",url->GetFile());
+      
+      local[ShortHost(url->GetHost())].push_back(file);
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    for ( std::map<std::string,std::vector<IndexedFile> >::const_iterator it = local.begin(); it != local.end(); ++it )
+    {
+      std::vector<IndexedFile>& files = added[it->first];
+      
+      files.insert(files.end(),it->second.begin(),it->second.end());
+      updated[dsname].fServers.insert(it->first);
+    }
+  });
+  
+  // datasets whose old entries must go away, and the servers that had them
+  std::set<std::string> stale(gone);
+  
+  for ( std::map<std::string,IndexedDataSet>::const_iterator it = updated.begin(); it != updated.end(); ++it )
+  {
+    stale.insert(it->first);
+  }
+  
+  for ( std::set<std::string>::const_iterator it = stale.begin(); it != stale.end(); ++it )
+  {
+    std::map<std::string,IndexedDataSet>::const_iterator m = manifest.find(*it);
+    
+    if ( m != manifest.end() ) touched.insert(m->second.fServers.begin(),m->second.fServers.end());
+  }
+  
+  for ( std::map<std::string,std::vector<IndexedFile> >::const_iterator it = added.begin(); it != added.end(); ++it )
+  {
+    touched.insert(it->first);
+  }
+  
+  gSystem->mkdir(idxdir.Data(),kTRUE);
+  
+  for ( std::set<std::string>::const_iterator s = touched.begin(); s != touched.end(); ++s )
+  {
+    std::vector<IndexedFile> files;
+    
+    if (!rebuild) ReadServerIndex(idxdir,*s,files);
+    
+    std::vector<IndexedFile> kept;
+    
+    for ( std::vector<IndexedFile>::const_iterator f = files.begin(); f != files.end(); ++f )
+    {
+      if ( !stale.count(f->fDataSet) ) kept.push_back(*f);
+    }
+    
+    std::map<std::string,std::vector<IndexedFile> >::const_iterator a = added.find(*s);
+    
+    if ( a != added.end() ) kept.insert(kept.end(),a->second.begin(),a->second.end());
+    
+    TString idx(Form("%s/%s.idx",idxdir.Data(),s->c_str()));
+    TString list(Form("%s/%s.list",idxdir.Data(),s->c_str()));
+    
+    if ( kept.empty() )
+    {
+      gSystem->Unlink(idx.Data());
+      gSystem->Unlink(list.Data());
+      continue;
+    }
+    
+    std::ofstream out(idx.Data());
+    std::set<std::string> urls;
+    
+    for ( std::vector<IndexedFile>::const_iterator f = kept.begin(); f != kept.end(); ++f )
+    {
+      out << f->fDataSet << " " << f->fSize << " " << f->fUrl << std::endl;
+      urls.insert(f->fUrl);
+    }
+    
+    std::ofstream lout(list.Data());
+    
+    for ( std::set<std::string>::const_iterator u = urls.begin(); u != urls.end(); ++u )
+    {
+      lout << *u << std::endl;
+    }
+  }
+  
+  for ( std::set<std::string>::const_iterator it = gone.begin(); it != gone.end(); ++it )
+  {
+    manifest.erase(*it);
+  }
+  
+  for ( std::map<std::string,IndexedDataSet>::const_iterator it = updated.begin(); it != updated.end(); ++it )
+  {
+    manifest[it->first] = it->second;
+  }
+  
+  // write the manifest last, so an interrupted update is simply redone
+  std::ofstream out(Form("%s/%s",idxdir.Data(),kServerIndexManifest));
+  
+  for ( std::map<std::string,IndexedDataSet>::const_iterator it = manifest.begin(); it != manifest.end(); ++it )
+  {
+    std::string servers;
+    
+    for ( std::set<std::string>::const_iterator s = it->second.fServers.begin(); s != it->second.fServers.end(); ++s )
+    {
+      if (!servers.empty()) servers += ",";
+      servers += *s;
+    }
+    
+    out << it->first << " " << it->second.fModTime << " " << it->second.fSize << " " << servers << std::endl;
+  }
+  
+  std::cout << Form("%lu datasets indexed : %lu (re)read (%d unreadable), %lu removed, %lu servers updated in %s",
+                    manifest.size(),updated.size(),nbad,gone.size(),touched.size(),idxdir.Data()) << std::endl;
+}
+
+//_______________________________________________________________________
+void VAF::ServerImpact(const char* indexDir, const char* servers)
+{
+  /// Tell which datasets lose files, and how many bytes, if the (comma separated)
+  /// servers are gone, using the index maintained by BuildServerIndex.
+  /// The list of files of each server is also written to <server>.list in the
+  /// current directory, ready for repopulate/list-input.sh.
+  /// Servers are known by their short name (the domain, if given, is ignored).
+  
+  TString idxdir(indexDir);
+  
+  gSystem->ExpandPathName(idxdir);
+  
+  std::map<std::string,std::pair<Long64_t,Long64_t> > impact; // dataset -> (files,bytes)
+  std::set<std::string> seen;
+  Long64_t nfiles(0);
+  Long64_t nbytes(0);
+  
+  TObjArray* a = TString(servers).Tokenize(", ");
+  TIter next(a);
+  TObjString* str;
+  
+  while ( ( str = static_cast<TObjString*>(next()) ) )
+  {
+    std::string server(ShortHost(str->String().Data()));
+    std::vector<IndexedFile> files;
+    
+    ReadServerIndex(idxdir,server,files);
+    
+    if ( files.empty() )
+    {
+      std::cout << "No file indexed for server " << server << std::endl;
+      continue;
+    }
+    
+    std::ofstream out(Form("%s.list",server.c_str()));
+    
+    for ( std::vector<IndexedFile>::const_iterator f = files.begin(); f != files.end(); ++f )
+    {
+      out << f->fUrl << std::endl;
+      
+      // a dataset file may be listed by several datasets
+      if ( !seen.insert(f->fDataSet + " " + f->fUrl).second ) continue;
+      
+      std::pair<Long64_t,Long64_t>& p = impact[f->fDataSet];
+      
+      p.first += 1;
+      p.second += f->fSize;
+    }
+    
+    std::cout << Form("%-40s %8lu files -> %s.list",server.c_str(),files.size(),server.c_str()) << std::endl;
+  }
+  
+  delete a;
+  
+  std::vector<std::pair<Long64_t,std::string> > sorted;
+  
+  for ( std::map<std::string,std::pair<Long64_t,Long64_t> >::const_iterator it = impact.begin(); it != impact.end(); ++it )
+  {
+    sorted.push_back(std::make_pair(it->second.second,it->first));
+  }
+  
+  std::sort(sorted.rbegin(),sorted.rend());
+  
+  for ( std::vector<std::pair<Long64_t,std::string> >::const_iterator it = sorted.begin(); it != sorted.end(); ++it )
+  {
+    const std::pair<Long64_t,Long64_t>& p = impact[it->second];
+    
+    std::cout << Form("%-80s %8lld files %10.2f GB",it->second.c_str(),p.first,p.second/byte2GB) << std::endl;
+    
+    nfiles += p.first;
+    nbytes += p.second;
+  }
+  
+  std::cout << Form("%lu datasets affected, %lld files, %.2f GB to re-stage",sorted.size(),nfiles,nbytes/byte2GB) << std::endl;
+}
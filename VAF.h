@@ -11,6 +11,7 @@ class TMap;
 #include "TDatime.h"
 #include "Riostream.h"
 #include <map>
+#include <string>
 
 class TTree;
 class TObjArray;
@@ -23,6 +24,13 @@ class VAF : public TObject
 {
 public:
   
+  /// How thoroughly the files are verified when checking datasets
+  enum ECheckLevel
+  {
+    kFullCheck=0, // read every entry of the tree (i.e. build the event objects)
+    kFastCheck=1 // read and decompress every basket, without building the event objects
+  };
+  
   static VAF* Create(const char* af);
   
   VAF(const char* master);
@@ -53,6 +61,10 @@ public:
   
   void TestDataSets(const char* txtfile, Bool_t requestStagingIfNotStaged=kFALSE);
   
+  void PlanStaging(const char* dsList, Double_t reserve=0.05);
+  
+  void GetFreeSpacePerServer(std::map<std::string,Long64_t>& freeSpace, std::map<std::string,Long64_t>* capacity=0x0);
+  
   virtual void CreateDataSets(const std::vector<int>& runs,
                               const char* dataType = "aodmuon",
                               const char* esdpass="pass2",
@@ -75,6 +87,9 @@ public:
                       Int_t fileLimit=-1);
 
   void GetOneDataSetSize(const char* dsname, Int_t& nFiles, Int_t& nCorruptedFiles, Long64_t& size, Bool_t showDetails=kFALSE);
+  
+  void GetDataSetSummaries(const TList& dsnames, TMap& summaries, Bool_t refresh=kFALSE);
+  
   void GroupDatasets();
 
   Int_t CheckOneDataSet(const char* dsname, std::ofstream& out);
@@ -135,7 +150,7 @@ public:
 
   Bool_t Connect(const char* option="masteronly");
   
-  static void CopyFromRemote(const char* txtfile="saf.aods.txt");
+  static void CopyFromRemote(const char* txtfile="saf.aods.txt", Int_t nthreads=1, Int_t maxPerHost=2, Int_t maxRetries=3);
 
   void ShowTransfers();
 
@@ -143,13 +158,58 @@ public:
   
   void ForceUpdate(Bool_t force=kTRUE) { fForceUpdate = force; }
   
-  static void FindDuplicates(const char* filelist, int format=1);
+  void SetCache(const char* cachedir, Int_t ttl) { fCacheDir = cachedir; fCacheTTL = ttl; }
+  
+  TString CacheDir() const { return fCacheDir; }
+  
+  Int_t CacheTTL() const { return fCacheTTL; }
+  
+  TFileCollection* GetDataSet(const char* dsname, Bool_t refresh=kFALSE);
+  
+  void SetParallelism(Int_t n) { fParallelism = n; }
+  
+  Int_t Parallelism() const { return fParallelism; }
+  
+  void SetCheckLevel(ECheckLevel level) { fCheckLevel = level; }
+  
+  ECheckLevel CheckLevel() const { return static_cast<ECheckLevel>(fCheckLevel); }
+  
+  void SetSampling(Double_t fileFraction, Double_t entryFraction=1.0, UInt_t seed=4357, Int_t escalation=2)
+  { fSampleFileFraction = fileFraction; fSampleEntryFraction = entryFraction; fSampleSeed = seed; fSampleEscalation = escalation; }
+  
+  Bool_t IsSampling() const { return fSampleFileFraction < 1.0 || fSampleEntryFraction < 1.0; }
+  
+  void SetMergeFanIn(Int_t fanIn) { fMergeFanIn = fanIn; }
+  
+  Int_t MergeFanIn() const { return fMergeFanIn; }
+  
+  void SetMergeOnServers(Bool_t flag=kTRUE) { fMergeOnServers = flag; }
+  
+  Bool_t MergeOnServers() const { return fMergeOnServers; }
+  
+  void SetMergeLimits(Int_t maxReadsPerServer, Int_t maxWrites) { fMaxReadsPerServer = maxReadsPerServer; fMaxWrites = maxWrites; }
+  
+  void SetJournalDir(const char* dir) { fJournalDir = dir; }
+  
+  TString JournalDir() const { return fJournalDir; }
+  
+  void ShowCheckProgress(const char* dsname);
+  
+  void InvalidateCache(const char* dsname="");
+  
+  static void FindDuplicates(const char* filelist, int format=1, const char* occupancyFile="");
   
   void EmergencyRemoval();
   
   void CloseConnection();
   
   static void RootFileSize(const char* filename, Bool_t showBranches=kTRUE);
+  
+  void ProfileBranchSizes(const char* input, const char* output, const char* format="csv");
+  
+  void AdviseCompression(const char* input, const char* output, Int_t basketsPerBranch=5, Int_t maxFiles=10);
+  
+  void GetFileList(const char* input, std::vector<std::string>& files);
 
   TString DecodeDataType(const char* dataType, TString& what, TString& treeName, TString& anchor, Int_t aodPassNumber) const;
 
@@ -163,9 +223,12 @@ public:
 
   static void ReadIntegers(const char* filename, std::vector<int>& integers);
   
-  static int ReadTree(const char* treename);
+  static int ReadTree(const char* treename, Double_t entryFraction=1.0, UInt_t seed=4357);
   
-  static int TestROOTFile(const char* file, const char* treename);
+  static int ReadBaskets(const char* treename, Double_t entryFraction=1.0, UInt_t seed=4357);
+  
+  static int TestROOTFile(const char* file, const char* treename, Bool_t verbose=kTRUE, ECheckLevel level=kFullCheck,
+                          Double_t entryFraction=1.0, UInt_t seed=4357);
   
   static void GetBranchSizes(TTree* tree, Long64_t& zipBytes, Long64_t& totBytes, TObjArray* lines);
 
@@ -174,9 +237,23 @@ public:
   static void ExtractFileList(const char* datasetDir, const char* serverName);
   static void GetFilesFromServer(const char* file, const char* server, TFileCollection& fileList);
 
+  void BuildServerIndex(const char* datasetDir, const char* indexDir, Bool_t rebuild=kFALSE);
+  
+  static void ServerImpact(const char* indexDir, const char* servers);
+
 private:
   void UpdateConnectString();
   
+  TString CacheFileName(const char* dsname) const;
+  
+  TFileCollection* GetCachedDataSet(const char* dsname) const;
+  
+  TString JournalFileName(const char* dsname) const;
+  
+  Bool_t MergeFileList(const std::vector<std::string>& inputs, const char* output, Int_t nthreads=-1) const;
+  
+  Bool_t MergeFileCollectionOnServers(TFileCollection& fc, const char* output);
+  
 protected:
   TString fConnect; // Connect string (afmaster)
   Bool_t fDryRun; // whether to do real things or just show what would be done
@@ -191,8 +268,21 @@ protected:
   Char_t fFileTypeToLookFor; // file type (f for file or l for link) to look for in GenerateReports
   TString fAliPhysics; // AliPhysics version (vAN-YYYYMMDD) to be used for filtering
   Bool_t fForceUpdate; // For dynamic dataset, force update of queries
-  
-  ClassDef(VAF,10)
+  TString fCacheDir; // local directory where the datasets are cached
+  Int_t fCacheTTL; // time to live (in seconds) of the cached datasets (<=0 to disable the cache)
+  Int_t fParallelism; // maximum number of files dealt with at the same time (e.g. when checking datasets)
+  Int_t fCheckLevel; // how files are verified when checking datasets (see ECheckLevel)
+  Double_t fSampleFileFraction; // fraction of the files of a dataset to be checked
+  Double_t fSampleEntryFraction; // fraction of the entries to be checked within each file
+  UInt_t fSampleSeed; // random seed of the sampling (fixed so that checks are reproducible)
+  Int_t fSampleEscalation; // number of sampled failures in one run or server triggering a full check of it
+  TString fJournalDir; // local directory where the dataset checks are journaled (empty to disable)
+  Int_t fMergeFanIn; // max number of files merged together in one go (<=1 to merge all files at once)
+  Int_t fMaxReadsPerServer; // max number of concurrent merges reading from one server (MergeDataSets)
+  Int_t fMaxWrites; // max number of concurrent merges writing to the output disk (MergeDataSets)
+  Bool_t fMergeOnServers; // whether MergeOneDataSet does a first merge stage on the data servers
+  
+  ClassDef(VAF,18)
 };
 
 #endif
@@ -1,6 +1,15 @@
 #include "CopyFromRemote.h"
+#include <cstdlib>
+#include <iostream>
 
 int main(int argc, char **argv) {
-  CopyFromRemote(argv[1]);
+  if ( argc < 2 ) {
+    std::cout << "Usage : " << argv[0] << " urllist.txt|dataset.root [nthreads [max copies per host [max retries]]]" << std::endl;
+    return 1;
+  }
+  CopyFromRemote(argv[1],
+                 argc > 2 ? atoi(argv[2]) : 1,
+                 argc > 3 ? atoi(argv[3]) : 2,
+                 argc > 4 ? atoi(argv[4]) : 3);
   return 0;
 }
@@ -18,9 +18,16 @@ int usage() {
   std::cout << "-- showds : show the content of one dataset (or several if option is the name of a text file containing the IDs of datasets)"<< std::endl;
   std::cout << "-- clear : clear the list of packages from the user"<< std::endl;
   std::cout << "-- packages : show the list of available packages "<< std::endl;
+  std::cout << "-- clearcache [dataset] : remove one dataset (or all of them) from the local dataset cache"<< std::endl;
+  std::cout << "-- checkprogress dataset : show the progress (and ETA) of the check of one dataset, from its journal"<< std::endl;
   std::cout << std::endl;
   std::cout << "-- stagerlog : (advanced) show the logfile of the stager daemon" << std::endl;
   std::cout << "-- df : (advanced) get the disk usage on the AF"<< std::endl;
+  std::cout << "-- branchprofile dataset|filelist output.csv|output.json : (advanced) aggregate the branch sizes of all the files of a dataset (or list of files)"<< std::endl;
+  std::cout << "-- zipadvice dataset|filelist|file output.csv : (advanced) project the size and decompression speed of the trees with each compression algorithm and level"<< std::endl;
+  std::cout << "-- serverindex datasetdir indexdir : (advanced) update (for the datasets changed since last time) the list of files of every server (read from the dataset files in datasetdir) in indexdir"<< std::endl;
+  std::cout << "-- impact indexdir server1,server2 : (advanced) show the datasets losing files if those servers are gone, and write <server>.list (uses the serverindex)"<< std::endl;
+  std::cout << "-- plan dslist : (advanced) tell whether (and where) the staging of the datasets listed in the dslist text file would fit"<< std::endl;
   std::cout << "-- xferlog filename : (advanced) get the log of a failed transfer "<< std::endl;
   std::cout << "-- conf : (advanced) show the configuration files of the AF "<< std::endl;
   std::cout << "-- xfers : (advanced) show the # of current file transfers the AF "<< std::endl;
@@ -79,6 +86,26 @@ int main(int argc, char* argv[])
     af->ShowDiskUsage();
   }
   
+  if ( command == "branchprofile" ) {
+    af->ProfileBranchSizes(option.c_str(),detail.c_str(),TString(detail.c_str()).EndsWith(".json") ? "json" : "csv");
+  }
+  
+  if ( command == "zipadvice" ) {
+    af->AdviseCompression(option.c_str(),detail.c_str());
+  }
+  
+  if ( command == "serverindex" ) {
+    af->BuildServerIndex(option.c_str(),detail.c_str());
+  }
+  
+  if ( command == "impact" ) {
+    af->ServerImpact(option.c_str(),detail.c_str());
+  }
+  
+  if ( command == "plan" ) {
+    af->PlanStaging(option.c_str());
+  }
+  
   if  ( command == "clear" ) {
     af->ClearPackages();
   }
@@ -103,6 +130,14 @@ int main(int argc, char* argv[])
     af->ShowDataSetContent(option.c_str());
   }
   
+  if ( command == "clearcache" ) {
+    af->InvalidateCache(option.c_str());
+  }
+  
+  if ( command == "checkprogress" ) {
+    af->ShowCheckProgress(option.c_str());
+  }
+  
   if ( command == "xfers") {
     af->ShowTransfers();
   }
@@ -2,17 +2,22 @@
 #include <iostream>
 #include "dirent.h"
 #include <cstring>
+#include <cstdlib>
 
 int main(int argc, char* argv[])
 {
   std::string topdir;
   std::string prefix("/data");
   std::string pattern("nan");
+  std::string history;
+  double capacity(0);
+  double tolerance(-1);
+  double rate(0);
   int debug(0);
 
   if ( argc == 1 )
   {
-    std::cout << "Usage : webmaker --directory [where to find the files] --pattern [starting part of the filenames to look for] --prefix [prefix to strip from the fullpath of the results of the find command] (--debug) (--debug) (--debug) (--debug)" << std::endl;
+    std::cout << "Usage : webmaker --directory [where to find the files] --pattern [starting part of the filenames to look for] --prefix [prefix to strip from the fullpath of the results of the find command] (--history [file where to keep the history of the disk usage]) (--capacity [disk capacity of one server in GB]) (--rebalance [tolerance in % around the mean server occupancy] (--rebalancerate [max GB per hour per server])) (--debug) (--debug) (--debug) (--debug)" << std::endl;
 
   }
   for ( int i = 1; i < argc; ++i)
@@ -35,6 +40,30 @@ int main(int argc, char* argv[])
       ++i;
     }
 
+    else if ( !strcmp(argv[i],"--history") )
+    {
+      history = argv[i+1];
+      ++i;
+    }
+
+    else if ( !strcmp(argv[i],"--capacity") )
+    {
+      capacity = atof(argv[i+1]);
+      ++i;
+    }
+
+    else if ( !strcmp(argv[i],"--rebalance") )
+    {
+      tolerance = atof(argv[i+1])/100.0;
+      ++i;
+    }
+
+    else if ( !strcmp(argv[i],"--rebalancerate") )
+    {
+      rate = atof(argv[i+1]);
+      ++i;
+    }
+
     else if ( !strcmp(argv[i],"--debug") )
     {
       debug++;
@@ -59,6 +88,10 @@ int main(int argc, char* argv[])
 
   AFWebMaker wm(topdir,pattern,prefix,debug);
 
+  wm.SetHistoryFile(history);
+  wm.SetServerCapacity(static_cast<AFWebMaker::AFFileSize>(capacity*1024*1024*1024));
+  wm.SetRebalancing(tolerance,static_cast<AFWebMaker::AFFileSize>(rate*1024*1024*1024));
+
   wm.GenerateReports();
 
   return 0;